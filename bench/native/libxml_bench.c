@@ -0,0 +1,172 @@
+// Native microbenchmarks for the libxml2 calls wrapped by src/libxml_nif.c.
+//
+// Measures the C side alone, without the NIF boundary, so regressions can be
+// attributed either to libxml2 itself or to the wrapper.
+//
+//   make bench_native
+//   ./bench/native/libxml_bench [iterations] [size_in_bytes...]
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/c14n.h>
+#include <libxml/xpath.h>
+#include <libxml/xmlschemas.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  char* data;
+  size_t size;
+} buffer;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int compare_double(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// same shape as LibxmlBench.Generator.catalog/1
+static buffer generate_catalog(size_t size) {
+  buffer buf;
+  size_t cap = size + 4096;
+  buf.data = (char*)malloc(cap);
+  buf.size = 0;
+  buf.size += sprintf(buf.data, "<?xml version=\"1.0\"?>\n<catalog>\n");
+  for (int i = 1; buf.size < size || i == 1; i++) {
+    if (buf.size + 256 > cap) {
+      cap *= 2;
+      buf.data = (char*)realloc(buf.data, cap);
+    }
+    buf.size += sprintf(buf.data + buf.size,
+                        "<item id=\"%d\"><name>item %d</name><price>%d.00</price>"
+                        "<tags><tag>a</tag><tag>b</tag></tags><note><![CDATA[x]]></note></item>\n",
+                        i, i, (i * 7919) % 100000);
+  }
+  if (buf.size + 32 > cap) {
+    buf.data = (char*)realloc(buf.data, buf.size + 32);
+  }
+  buf.size += sprintf(buf.data + buf.size, "</catalog>\n");
+  return buf;
+}
+
+typedef void (*bench_fun)(void* arg);
+
+static void report(const char* name, size_t bytes, double* samples, int n) {
+  qsort(samples, n, sizeof(double), compare_double);
+  double total = 0;
+  for (int i = 0; i < n; i++) {
+    total += samples[i];
+  }
+  double mean = total / n;
+  printf("%-28s %10zu B  mean %12.0f ns  p50 %12.0f  p90 %12.0f  p99 %12.0f  %9.2f MB/s\n",
+         name, bytes, mean, samples[n / 2], samples[n * 9 / 10], samples[n * 99 / 100],
+         bytes / (mean / 1e9) / (1024 * 1024));
+}
+
+static void run(const char* name, size_t bytes, int iterations, bench_fun fun, void* arg) {
+  double* samples = (double*)malloc(sizeof(double) * iterations);
+  // warm up
+  fun(arg);
+  for (int i = 0; i < iterations; i++) {
+    double start = now_ns();
+    fun(arg);
+    samples[i] = now_ns() - start;
+  }
+  report(name, bytes, samples, iterations);
+  free(samples);
+}
+
+static void bench_read_memory(void* arg) {
+  buffer* buf = (buffer*)arg;
+  xmlDocPtr doc = xmlReadMemory(buf->data, buf->size, "noname.xml", NULL, 0);
+  xmlFreeDoc(doc);
+}
+
+static void bench_xpath_eval(void* arg) {
+  xmlDocPtr doc = (xmlDocPtr)arg;
+  xmlXPathContextPtr ctx = xmlXPathNewContext(doc);
+  xmlXPathObjectPtr obj = xmlXPathEval((const xmlChar*)"//item/name", ctx);
+  xmlXPathFreeObject(obj);
+  xmlXPathFreeContext(ctx);
+}
+
+static long walk(xmlNodePtr node) {
+  long count = 0;
+  for (; node != NULL; node = node->next) {
+    count += 1 + walk(node->children);
+  }
+  return count;
+}
+
+static volatile long walk_sink;
+
+static void bench_traversal(void* arg) {
+  xmlDocPtr doc = (xmlDocPtr)arg;
+  walk_sink = walk(doc->children);
+}
+
+static void bench_c14n(void* arg) {
+  xmlDocPtr doc = (xmlDocPtr)arg;
+  xmlChar* output = NULL;
+  xmlC14NDocDumpMemory(doc, NULL, 0, NULL, 0, &output);
+  xmlFree(output);
+}
+
+typedef struct {
+  xmlSchemaValidCtxtPtr ctxt;
+  xmlDocPtr doc;
+} validate_arg;
+
+static void bench_validate(void* arg) {
+  validate_arg* v = (validate_arg*)arg;
+  if (xmlSchemaValidateDoc(v->ctxt, v->doc) != 0) {
+    fprintf(stderr, "validation failed\n");
+    exit(1);
+  }
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20;
+  size_t default_sizes[] = { 1024, 100 * 1024, 10 * 1024 * 1024 };
+  int nsizes = argc > 2 ? argc - 2 : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+
+  xmlInitParser();
+
+  xmlSchemaParserCtxtPtr pctxt = xmlSchemaNewParserCtxt("bench/catalog.xsd");
+  xmlSchemaPtr schema = pctxt == NULL ? NULL : xmlSchemaParse(pctxt);
+  if (schema == NULL) {
+    fprintf(stderr, "failed to load bench/catalog.xsd (run from the repository root)\n");
+    return 1;
+  }
+  xmlSchemaValidCtxtPtr vctxt = xmlSchemaNewValidCtxt(schema);
+
+  for (int i = 0; i < nsizes; i++) {
+    size_t size = argc > 2 ? (size_t)strtoull(argv[i + 2], NULL, 10) : default_sizes[i];
+    buffer buf = generate_catalog(size);
+    xmlDocPtr doc = xmlReadMemory(buf.data, buf.size, "noname.xml", NULL, 0);
+
+    run("xmlReadMemory", buf.size, iterations, bench_read_memory, &buf);
+    run("xmlXPathEval //item/name", buf.size, iterations, bench_xpath_eval, doc);
+    run("children/next traversal", buf.size, iterations, bench_traversal, doc);
+    validate_arg v = { vctxt, doc };
+    run("xmlSchemaValidateDoc", buf.size, iterations, bench_validate, &v);
+    run("xmlC14NDocDumpMemory", buf.size, iterations, bench_c14n, doc);
+
+    xmlFreeDoc(doc);
+    free(buf.data);
+  }
+
+  xmlSchemaFreeValidCtxt(vctxt);
+  xmlSchemaFree(schema);
+  xmlSchemaFreeParserCtxt(pctxt);
+  xmlCleanupParser();
+  return 0;
+}
@@ -0,0 +1,152 @@
+# Usage:
+#
+#   mix bench                     # all suites
+#   mix bench parse c14n          # selected suites
+#
+# BENCH_SIZES (default "1KB,100KB,10MB,100MB") and BENCH_TIME (seconds per
+# scenario, default 5) control the generated inputs and run length.
+
+Code.require_file("support.exs", __DIR__)
+
+sizes = LibxmlBench.Generator.sizes()
+schema_path = Path.join(__DIR__, "catalog.xsd")
+
+suites = %{
+  "parse" => fn ->
+    inputs = LibxmlBench.prepare(sizes, & &1)
+
+    LibxmlBench.run(
+      "parse",
+      %{"Libxml.read_memory" => fn xml -> Libxml.free_doc(Libxml.read_memory(xml)) end},
+      inputs
+    )
+  end,
+  "xpath" => fn ->
+    inputs = LibxmlBench.prepare(sizes, &Libxml.read_memory/1)
+
+    eval = fn xpath ->
+      fn doc ->
+        Libxml.XPath.safe_new_context(doc, fn ctx ->
+          Libxml.XPath.safe_eval(ctx, xpath, &Libxml.XPath.Object.extract/1)
+        end)
+      end
+    end
+
+    LibxmlBench.run(
+      "xpath",
+      %{
+        "Libxml.XPath.eval //item/name" => eval.("//item/name"),
+        "Libxml.XPath.eval count(//tag)" => eval.("count(//tag)"),
+        "Libxml.XPath.eval /catalog/item[last()]/@id" => eval.("/catalog/item[last()]/@id")
+      },
+      inputs
+    )
+
+    for {_, {_, doc}} <- inputs, do: Libxml.free_doc(doc)
+  end,
+  "traversal" => fn ->
+    inputs = LibxmlBench.prepare(sizes, &Libxml.read_memory/1)
+
+    # depth first walk over children/next pointers with Libxml.Nif.get_xml_node/1
+    walk = fn
+      _walk, [], count ->
+        count
+
+      walk, [0 | rest], count ->
+        walk.(walk, rest, count)
+
+      walk, [pointer | rest], count ->
+        {:ok, node} = Libxml.Nif.get_xml_node(pointer)
+        walk.(walk, [node.children, node.next | rest], count + 1)
+    end
+
+    LibxmlBench.run(
+      "traversal",
+      %{"Libxml.Nif.get_xml_node" => fn doc -> walk.(walk, [doc.pointer], 0) end},
+      inputs
+    )
+
+    for {_, {_, doc}} <- inputs, do: Libxml.free_doc(doc)
+  end,
+  "schema" => fn ->
+    LibxmlBench.run(
+      "schema parse",
+      %{
+        "Libxml.Schema.parse" => fn path ->
+          Libxml.Schema.safe_new_parser_ctxt(path, fn ctxt ->
+            Libxml.Schema.safe_parse(ctxt, fn _schema, [] -> :ok end)
+          end)
+        end
+      },
+      %{"catalog.xsd" => {File.stat!(schema_path).size, schema_path}}
+    )
+
+    inputs = LibxmlBench.prepare(sizes, &Libxml.read_memory/1)
+
+    Libxml.Schema.safe_new_parser_ctxt(schema_path, fn ctxt ->
+      Libxml.Schema.safe_parse(ctxt, fn schema, [] ->
+        Libxml.Schema.safe_new_valid_ctxt(schema, fn valid_ctxt ->
+          LibxmlBench.run(
+            "schema validate",
+            %{
+              "Libxml.Schema.validate_doc" => fn doc ->
+                {:ok, []} = Libxml.Schema.validate_doc(valid_ctxt, doc)
+              end
+            },
+            inputs
+          )
+        end)
+      end)
+    end)
+
+    for {_, {_, doc}} <- inputs, do: Libxml.free_doc(doc)
+  end,
+  "snapshot" => fn ->
+    inputs =
+      LibxmlBench.prepare(sizes, fn xml ->
+        {xml, Libxml.safe_read_memory(xml, &Libxml.Snapshot.dump/1)}
+      end)
+
+    LibxmlBench.run(
+      "snapshot",
+      %{
+        "Libxml.read_memory" => fn {xml, _} -> Libxml.free_doc(Libxml.read_memory(xml)) end,
+        "Libxml.Snapshot.load" => fn {_, snapshot} ->
+          Libxml.free_doc(Libxml.Snapshot.load(snapshot))
+        end
+      },
+      inputs
+    )
+  end,
+  "c14n" => fn ->
+    inputs = LibxmlBench.prepare(sizes, &Libxml.read_memory/1)
+
+    LibxmlBench.run(
+      "c14n",
+      %{
+        "Libxml.C14N.doc_dump_memory" => fn doc ->
+          Libxml.C14N.doc_dump_memory(doc, nil, :c14n_1_0, [], false)
+        end,
+        "Libxml.C14N.doc_dump_memory exclusive" => fn doc ->
+          Libxml.C14N.doc_dump_memory(doc, nil, :c14n_exclusive_1_0, [], true)
+        end
+      },
+      inputs
+    )
+
+    for {_, {_, doc}} <- inputs, do: Libxml.free_doc(doc)
+  end
+}
+
+selected =
+  case System.argv() do
+    [] -> Map.keys(suites)
+    names -> names
+  end
+
+for name <- selected do
+  case Map.fetch(suites, name) do
+    {:ok, suite} -> suite.()
+    :error -> Mix.raise("unknown suite #{name}, expected one of #{inspect(Map.keys(suites))}")
+  end
+end
@@ -0,0 +1,128 @@
+defmodule LibxmlBench.Generator do
+  @item_size byte_size(
+               "<item id=\"0000000\"><name>item 0000000</name><price>0000000.00</price>" <>
+                 "<tags><tag>a</tag><tag>b</tag></tags><note><![CDATA[x]]></note></item>\n"
+             )
+
+  # Generates a <catalog> document of roughly `size` bytes which is valid
+  # against bench/catalog.xsd.
+  def catalog(size) do
+    count = max(div(size, @item_size), 1)
+
+    items =
+      for i <- 1..count do
+        id = Integer.to_string(i)
+
+        [
+          "<item id=\"",
+          id,
+          "\"><name>item ",
+          id,
+          "</name><price>",
+          Integer.to_string(rem(i * 7919, 100_000)),
+          ".00</price><tags><tag>a</tag><tag>b</tag></tags><note><![CDATA[x]]></note></item>\n"
+        ]
+      end
+
+    IO.iodata_to_binary(["<?xml version=\"1.0\"?>\n<catalog>\n", items, "</catalog>\n"])
+  end
+
+  def parse_size("" <> size) do
+    {value, unit} = Integer.parse(size)
+
+    case String.upcase(unit) do
+      "" -> value
+      "B" -> value
+      "KB" -> value * 1024
+      "MB" -> value * 1024 * 1024
+    end
+  end
+
+  def sizes() do
+    System.get_env("BENCH_SIZES", "1KB,100KB,10MB,100MB")
+    |> String.split(",", trim: true)
+    |> Enum.map(&{&1, parse_size(&1)})
+  end
+end
+
+defmodule LibxmlBench.Blocking do
+  # Runs `fun` `runs` times with a long_schedule system monitor installed and
+  # reports how often, and for how long at most, a normal scheduler was
+  # blocked by a single call.
+  def measure(fun, runs, threshold_ms \\ 1) do
+    previous = :erlang.system_monitor(self(), [{:long_schedule, threshold_ms}])
+
+    try do
+      for _ <- 1..runs, do: fun.()
+    after
+      case previous do
+        :undefined -> :erlang.system_monitor(:undefined)
+        {pid, options} -> :erlang.system_monitor(pid, options)
+      end
+    end
+
+    timeouts = collect([])
+
+    %{
+      runs: runs,
+      long_schedules: length(timeouts),
+      max_blocking_ms: Enum.max(timeouts, fn -> 0 end)
+    }
+  end
+
+  defp collect(acc) do
+    receive do
+      {:monitor, _pid, :long_schedule, info} -> collect([info[:timeout] | acc])
+    after
+      0 -> acc
+    end
+  end
+end
+
+defmodule LibxmlBench do
+  def run(name, jobs, inputs) do
+    IO.puts("\n== #{name}")
+
+    suite =
+      Benchee.run(
+        jobs,
+        inputs: Enum.map(inputs, fn {label, {_size, input}} -> {label, input} end),
+        time: String.to_integer(System.get_env("BENCH_TIME", "5")),
+        memory_time: 1,
+        reduction_time: 1,
+        formatters: [{Benchee.Formatters.Console, extended_statistics: true}]
+      )
+
+    report(suite, jobs, inputs)
+  end
+
+  # Throughput and scheduler blocking are not part of Benchee's console output.
+  defp report(suite, jobs, inputs) do
+    for scenario <- suite.scenarios do
+      {size, input} = Map.new(inputs)[scenario.input_name]
+      ips = scenario.run_time_data.statistics.ips
+      mb_per_sec = size * ips / (1024 * 1024)
+      fun = jobs[scenario.job_name]
+      blocking = LibxmlBench.Blocking.measure(fn -> fun.(input) end, 10)
+
+      IO.puts(
+        :io_lib.format("~-40s ~-8s ~10.2f MB/s  long_schedules ~2w/~w  max ~w ms", [
+          scenario.job_name,
+          scenario.input_name,
+          mb_per_sec,
+          blocking.long_schedules,
+          blocking.runs,
+          blocking.max_blocking_ms
+        ])
+      )
+    end
+
+    suite
+  end
+
+  def prepare(sizes, fun) do
+    for {label, size} <- sizes, into: %{} do
+      {label, {size, fun.(LibxmlBench.Generator.catalog(size))}}
+    end
+  end
+end
@@ -1,7 +1,9 @@
 defmodule Libxml do
   def read_memory(contents) do
-    {:ok, pointer} = Libxml.Nif.xml_read_memory(contents)
-    %Libxml.Node{pointer: pointer}
+    Libxml.Telemetry.span(:read_memory, %{}, fn ->
+      {:ok, pointer} = Libxml.Nif.xml_read_memory(contents)
+      {%Libxml.Node{pointer: pointer}, %{bytes: byte_size(contents)}}
+    end)
   end
 
   def free_doc(%Libxml.Node{pointer: pointer}) do
@@ -9,8 +11,61 @@ defmodule Libxml do
   end
 
   def safe_read_memory(contents, fun) do
-    {:ok, pointer} = Libxml.Nif.xml_read_memory(contents)
-    doc = %Libxml.Node{pointer: pointer}
+    doc = read_memory(contents)
+
+    try do
+      fun.(doc)
+    after
+      free_doc(doc)
+    end
+  end
+
+  # Parses `contents` but stops as soon as the part of the document the caller
+  # needs has been built, returning the partial document and why parsing ended
+  # (`:max_depth`, `:max_elements`, `:target` or `:eof`).
+  #
+  # Options:
+  #   * `:max_depth` - stop before an element deeper than this (0 = unlimited)
+  #   * `:max_elements` - stop before this many elements are built (0 = unlimited)
+  #   * `:target` - stop once the first element matching this streamable
+  #     pattern (e.g. `"/env/header"`) has been closed
+  #   * `:namespaces` - `[{prefix, uri}]` for prefixes used in `:target`
+  def read_memory_until(contents, opts) do
+    namespaces = Enum.flat_map(Keyword.get(opts, :namespaces, []), fn {prefix, uri} -> [uri, prefix] end)
+
+    Libxml.Telemetry.span(:read_memory, %{until: true}, fn ->
+      {:ok, {pointer, reason}} =
+        Libxml.Nif.xml_read_memory_until(
+          contents,
+          Keyword.get(opts, :max_depth, 0),
+          Keyword.get(opts, :max_elements, 0),
+          Keyword.get(opts, :target, ""),
+          namespaces
+        )
+
+      {{%Libxml.Node{pointer: pointer}, reason}, %{bytes: byte_size(contents)}}
+    end)
+  end
+
+  def safe_read_memory_until(contents, opts, fun) do
+    {doc, reason} = read_memory_until(contents, opts)
+
+    try do
+      fun.(doc, reason)
+    after
+      free_doc(doc)
+    end
+  end
+
+  def read_file(path) when is_binary(path) do
+    Libxml.Telemetry.span(:read_file, %{path: path}, fn ->
+      {:ok, pointer} = Libxml.Nif.xml_read_file(path)
+      {%Libxml.Node{pointer: pointer}, %{}}
+    end)
+  end
+
+  def safe_read_file(path, fun) when is_binary(path) do
+    doc = read_file(path)
 
     try do
       fun.(doc)
@@ -113,6 +168,14 @@ defmodule Libxml do
     %Libxml.Ns{pointer: pointer}
   end
 
+  # tree is `{name, [{attr_name, attr_value}], children}` where each child is
+  # either another tree or a binary (text node). The whole subtree is built in
+  # one NIF call; the returned node belongs to doc but is not linked anywhere.
+  def new_doc_tree(%Libxml.Node{pointer: doc_pointer}, tree) do
+    {:ok, pointer} = Libxml.Nif.xml_new_doc_tree(doc_pointer, tree)
+    %Libxml.Node{pointer: pointer}
+  end
+
   def unlink_node(%Libxml.Node{pointer: pointer}) do
     Libxml.Nif.xml_unlink_node(pointer)
   end
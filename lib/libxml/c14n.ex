@@ -2,34 +2,86 @@ defmodule Libxml.C14N do
   def doc_dump_memory(node, nodeset, mode, inclusive_ns_prefixes, with_comments) do
     %Libxml.Node{pointer: pointer, type: _document_node} = node
 
-    nodeset_value =
-      case nodeset do
-        nil -> 0
-        %Libxml.XPath.NodeSet{pointer: pointer} -> pointer
-      end
+    Libxml.Telemetry.span(:c14n, %{mode: mode}, fn ->
+      {:ok, content} =
+        Libxml.Nif.xml_c14n_doc_dump_memory(
+          pointer,
+          nodeset_value(nodeset),
+          mode_value(mode),
+          inclusive_ns_prefixes,
+          with_comments_value(with_comments)
+        )
 
-    mode_value =
-      case mode do
-        :c14n_1_0 -> 0
-        :c14n_exclusive_1_0 -> 1
-        :c14n_1_1 -> 2
-      end
+      {content, %{bytes: byte_size(content)}}
+    end)
+  end
 
-    with_comments_value =
-      case with_comments do
-        true -> 1
-        false -> 0
-      end
+  # SHA-256 of the canonical form. The canonical bytes are streamed into the
+  # hash and never allocated as a binary.
+  def doc_digest(node, nodeset, mode, inclusive_ns_prefixes, with_comments) do
+    %Libxml.Node{pointer: pointer, type: _document_node} = node
+
+    Libxml.Telemetry.span(:c14n, %{mode: mode}, fn ->
+      {:ok, digest} =
+        Libxml.Nif.xml_c14n_doc_digest(
+          pointer,
+          nodeset_value(nodeset),
+          mode_value(mode),
+          inclusive_ns_prefixes,
+          with_comments_value(with_comments)
+        )
+
+      {digest, %{}}
+    end)
+  end
 
-    {:ok, content} =
-      Libxml.Nif.xml_c14n_doc_dump_memory(
-        pointer,
-        nodeset_value,
-        mode_value,
+  # Canonicalizes signature references in one NIF call. Each reference is ""
+  # (whole document), "#id" (element with that ID and its subtree) or an XPath
+  # expression (subtrees of the selected nodes). output is :bytes for the
+  # canonical forms or :sha256 for their digests, in reference order.
+  # namespaces is [{prefix, uri}] for prefixes used in XPath references, e.g.
+  # [{"wsu", "http://docs.oasis-open.org/..."}] for //wsu:Timestamp.
+  def references(
+        node,
+        references,
+        mode,
         inclusive_ns_prefixes,
-        with_comments_value
-      )
+        with_comments,
+        output \\ :bytes,
+        namespaces \\ []
+      ) do
+    %Libxml.Node{pointer: pointer, type: _document_node} = node
+    namespaces = Enum.flat_map(namespaces, fn {prefix, uri} -> [uri, prefix] end)
+
+    digest_value =
+      case output do
+        :bytes -> 0
+        :sha256 -> 1
+      end
+
+    Libxml.Telemetry.span(:c14n, %{mode: mode}, fn ->
+      {:ok, results} =
+        Libxml.Nif.xml_c14n_references(
+          pointer,
+          references,
+          mode_value(mode),
+          inclusive_ns_prefixes,
+          with_comments_value(with_comments),
+          digest_value,
+          namespaces
+        )
 
-    content
+      {results, %{}}
+    end)
   end
+
+  defp nodeset_value(nil), do: 0
+  defp nodeset_value(%Libxml.XPath.NodeSet{pointer: pointer}), do: pointer
+
+  defp mode_value(:c14n_1_0), do: 0
+  defp mode_value(:c14n_exclusive_1_0), do: 1
+  defp mode_value(:c14n_1_1), do: 2
+
+  defp with_comments_value(true), do: 1
+  defp with_comments_value(false), do: 0
 end
@@ -0,0 +1,34 @@
+defmodule Libxml.Digest do
+  # SHA-256 over the string values of the nodes selected by each XPath.
+  def xpath_fields(%Libxml.Node{pointer: pointer}, xpaths) when is_list(xpaths) do
+    {:ok, digest} = Libxml.Nif.xml_xpath_fields_digest(pointer, xpaths)
+    digest
+  end
+
+  defmodule Set do
+    # Backed by a NIF resource: share it between processes freely, it is
+    # freed when the last reference is garbage collected.
+    defstruct [:resource]
+
+    def new() do
+      {:ok, resource} = Libxml.Nif.xml_digest_set_new()
+      %__MODULE__{resource: resource}
+    end
+
+    # returns true if digest was not in the set before
+    def put(%__MODULE__{resource: resource}, digest) when is_binary(digest) do
+      {:ok, added} = Libxml.Nif.xml_digest_set_put(resource, digest)
+      added == 1
+    end
+
+    def member?(%__MODULE__{resource: resource}, digest) when is_binary(digest) do
+      {:ok, found} = Libxml.Nif.xml_digest_set_member(resource, digest)
+      found == 1
+    end
+
+    def size(%__MODULE__{resource: resource}) do
+      {:ok, size} = Libxml.Nif.xml_digest_set_size(resource)
+      size
+    end
+  end
+end
@@ -0,0 +1,41 @@
+defmodule Libxml.DTD do
+  # A parsed DTD is a NIF resource freed when the last process referencing it
+  # lets go. Validation does not modify it, so it can be shared between
+  # processes validating different documents.
+  defstruct [:resource]
+
+  # Returns {dtd, errors}, dtd is nil when the DTD is invalid.
+  def parse_file(path) when is_binary(path) do
+    Libxml.Telemetry.span(:dtd_parse, %{}, fn ->
+      {:ok, {dtd, errors}} = Libxml.Nif.xml_dtd_parse_file(path)
+      errors = Enum.map(errors, &Libxml.Error.from_map/1)
+      {{dtd_value(dtd), errors}, %{error_count: length(errors)}}
+    end)
+  end
+
+  def parse_memory(buffer) when is_binary(buffer) do
+    Libxml.Telemetry.span(:dtd_parse, %{}, fn ->
+      {:ok, {dtd, errors}} = Libxml.Nif.xml_dtd_parse_memory(buffer)
+      errors = Enum.map(errors, &Libxml.Error.from_map/1)
+      {{dtd_value(dtd), errors}, %{error_count: length(errors)}}
+    end)
+  end
+
+  def validate_doc(%__MODULE__{} = dtd, %Libxml.Node{} = doc) do
+    {ret, errors} =
+      Libxml.Telemetry.span(:dtd_validate, %{}, fn ->
+        {:ok, {ret, errors}} = Libxml.Nif.xml_validate_dtd(dtd.resource, doc.pointer)
+        errors = Enum.map(errors, &Libxml.Error.from_map/1)
+        {{ret, errors}, %{error_count: length(errors)}}
+      end)
+
+    if ret == 0 do
+      {:ok, errors}
+    else
+      {:error, errors}
+    end
+  end
+
+  defp dtd_value(nil), do: nil
+  defp dtd_value(resource), do: %__MODULE__{resource: resource}
+end
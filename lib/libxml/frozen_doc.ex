@@ -0,0 +1,36 @@
+defmodule Libxml.FrozenDoc do
+  # An immutable copy of a document held by a NIF resource. It can be sent to
+  # and queried from any number of processes concurrently, and is freed when
+  # the last process referencing it lets go, so there is no free/1.
+  defstruct [:resource]
+
+  def freeze(%Libxml.Node{pointer: pointer}) do
+    {:ok, resource} = Libxml.Nif.xml_freeze_doc(pointer)
+    %__MODULE__{resource: resource}
+  end
+
+  # Node sets are returned as lists of string values. Other results are
+  # binaries, booleans, floats or :nan, :infinity and :neg_infinity.
+  #
+  # `namespaces: [{prefix, uri}]` binds the prefixes used in the expression.
+  #
+  # With `zero_copy: true`, large text, CDATA and single-text attribute or
+  # element values are returned as binaries pointing into the frozen document
+  # instead of copies. Each one keeps the whole document alive, so use
+  # :binary.copy/1 on values that outlive the document's other users.
+  def xpath_eval(%__MODULE__{resource: resource}, xpath, opts \\ []) when is_binary(xpath) do
+    zero_copy = Keyword.get(opts, :zero_copy, false)
+
+    namespaces =
+      opts
+      |> Keyword.get(:namespaces, [])
+      |> Enum.flat_map(fn {prefix, uri} -> [uri, to_string(prefix)] end)
+
+    Libxml.Telemetry.span(:xpath_eval, %{frozen: true, zero_copy: zero_copy}, fn ->
+      {:ok, value} =
+        Libxml.Nif.xml_frozen_xpath_eval(resource, xpath, if(zero_copy, do: 1, else: 0), namespaces)
+
+      {value, if(is_list(value), do: %{node_count: length(value)}, else: %{})}
+    end)
+  end
+end
@@ -6,9 +6,20 @@ defmodule Libxml.Nif do
   end
 
   def xml_read_memory(_contents), do: raise("NIF not implemented")
+  def xml_read_file(_path), do: raise("NIF not implemented")
+  def xml_read_memory_until(_contents, _max_depth, _max_elements, _target, _namespaces), do: raise("NIF not implemented")
   def xml_copy_doc(_doc, _recursive), do: raise("NIF not implemented")
   def xml_free_doc(_doc), do: raise("NIF not implemented")
 
+  def xml_pattern_stream_memory(_contents, _patterns, _namespaces, _output),
+    do: raise("NIF not implemented")
+
+  def xml_pattern_stream_file(_path, _patterns, _namespaces, _output),
+    do: raise("NIF not implemented")
+
+  def xml_pattern_stream_next(_stream, _max), do: raise("NIF not implemented")
+  def xml_pattern_stream_close(_stream), do: raise("NIF not implemented")
+
   def xml_get_prop(_char, _attr_name), do: raise("NIF not implemented")
 
   def xml_doc_copy_node(_node, _doc, _extended), do: raise("NIF not implemented")
@@ -16,6 +27,10 @@ defmodule Libxml.Nif do
   def xml_doc_set_root_element(_doc, _node), do: raise("NIF not implemented")
 
   def xml_new_ns(_node, _href, _prefix), do: raise("NIF not implemented")
+  def xml_new_doc_tree(_doc, _tree), do: raise("NIF not implemented")
+
+  def xml_doc_to_snapshot(_doc), do: raise("NIF not implemented")
+  def xml_doc_from_snapshot(_snapshot), do: raise("NIF not implemented")
 
   def xml_unlink_node(_node), do: raise("NIF not implemented")
   def xml_copy_node(_node, _extended), do: raise("NIF not implemented")
@@ -25,14 +40,30 @@ defmodule Libxml.Nif do
   def xml_c14n_doc_dump_memory(_doc, _nodeset, _mode, _inclusive_ns_prefixes, _with_comments),
     do: raise("NIF not implemented")
 
+  def xml_c14n_doc_digest(_doc, _nodeset, _mode, _inclusive_ns_prefixes, _with_comments),
+    do: raise("NIF not implemented")
+
+  def xml_c14n_references(_doc, _refs, _mode, _prefixes, _with_comments, _digest, _namespaces),
+    do: raise("NIF not implemented")
+
+  def xml_xpath_fields_digest(_doc, _xpaths), do: raise("NIF not implemented")
+  def xml_digest_set_new(), do: raise("NIF not implemented")
+  def xml_digest_set_put(_set, _digest), do: raise("NIF not implemented")
+  def xml_digest_set_member(_set, _digest), do: raise("NIF not implemented")
+  def xml_digest_set_size(_set), do: raise("NIF not implemented")
+
   def xml_xpath_new_context(_doc), do: raise("NIF not implemented")
   def xml_xpath_free_context(_context), do: raise("NIF not implemented")
   def xml_xpath_eval(_ctx, _xpath), do: raise("NIF not implemented")
   def xml_xpath_free_object(_obj), do: raise("NIF not implemented")
 
+  def xml_freeze_doc(_doc), do: raise("NIF not implemented")
+  def xml_frozen_xpath_eval(_frozen, _xpath, _zero_copy, _namespaces), do: raise("NIF not implemented")
+
   def xml_schema_new_parser_ctxt(_url), do: raise("NIF not implemented")
   def xml_schema_new_doc_parser_ctxt(_doc), do: raise("NIF not implemented")
   def xml_schema_parse(_ctxt), do: raise("NIF not implemented")
+  def xml_schema_parse_memory(_buffer), do: raise("NIF not implemented")
   def xml_schema_new_valid_ctxt(_schema), do: raise("NIF not implemented")
   def xml_schema_validate_doc(_ctxt, _doc), do: raise("NIF not implemented")
   def xml_schema_free_parser_ctxt(_ctxt), do: raise("NIF not implemented")
@@ -40,6 +71,22 @@ defmodule Libxml.Nif do
   def xml_schema_free_valid_ctxt(_ctxt), do: raise("NIF not implemented")
   # def xml_schema_set_parser_errors(_ctxt, _err, _warn, _ctx), do: raise("NIF not implemented")
 
+  def xml_relaxng_new_parser_ctxt(_url), do: raise("NIF not implemented")
+  def xml_relaxng_new_doc_parser_ctxt(_doc), do: raise("NIF not implemented")
+  def xml_relaxng_parse(_ctxt), do: raise("NIF not implemented")
+  def xml_relaxng_parse_memory(_buffer), do: raise("NIF not implemented")
+  def xml_relaxng_new_valid_ctxt(_schema), do: raise("NIF not implemented")
+  def xml_relaxng_validate_doc(_ctxt, _doc), do: raise("NIF not implemented")
+
+  def xml_dtd_parse_file(_path), do: raise("NIF not implemented")
+  def xml_dtd_parse_memory(_buffer), do: raise("NIF not implemented")
+  def xml_validate_dtd(_dtd, _doc), do: raise("NIF not implemented")
+
+  def xslt_parse_stylesheet(_contents), do: raise("NIF not implemented")
+  def xslt_parse_stylesheet_doc(_doc), do: raise("NIF not implemented")
+  def xslt_apply_stylesheet(_style, _doc, _params), do: raise("NIF not implemented")
+  def xslt_transform(_style, _doc, _params), do: raise("NIF not implemented")
+
   def get_xml_node(_node), do: raise("NIF not implemented")
   def set_xml_node(_node, _map), do: raise("NIF not implemented")
   def get_xml_char(_char), do: raise("NIF not implemented")
@@ -48,4 +95,13 @@ defmodule Libxml.Nif do
   def set_xml_xpath_context(_obj, _map), do: raise("NIF not implemented")
   def get_xml_xpath_object(_obj), do: raise("NIF not implemented")
   def get_xml_node_set(_nodeset), do: raise("NIF not implemented")
+  def get_xml_node_set_page(_nodeset, _offset, _count, _mode), do: raise("NIF not implemented")
+
+  def xml_register_resource(_uri, _content), do: raise("NIF not implemented")
+  def xml_unregister_resource(_uri), do: raise("NIF not implemented")
+  def xml_clear_resources(), do: raise("NIF not implemented")
+  def xml_set_network_blocked(_blocked), do: raise("NIF not implemented")
+
+  def get_stats(), do: raise("NIF not implemented")
+  def reset_stats(), do: raise("NIF not implemented")
 end
@@ -0,0 +1,69 @@
+defmodule Libxml.Pattern do
+  # Extracts values matching streamable patterns (the XPath subset of
+  # xmlPattern, e.g. "/feed/entry/id", "//item/@id" or "a|b") while reading
+  # the input, without building a document. Every pattern matches on its own:
+  # a matched element is returned whole, followed by matches on its attributes
+  # and then on its descendants.
+  #
+  # Options:
+  #
+  #   namespaces: [{prefix, uri}] used by prefixed names in the patterns
+  #   output: :text (string value, default) or :outer_xml (serialized element)
+  #   batch_size: matches fetched per NIF call, a positive integer, default 1000
+  #
+  # Streams emit {pattern, value} in document order.
+
+  def stream_memory(contents, patterns, opts \\ []) when is_binary(contents) do
+    stream(&Libxml.Nif.xml_pattern_stream_memory/4, contents, patterns, opts)
+  end
+
+  def stream_file(path, patterns, opts \\ []) when is_binary(path) do
+    stream(&Libxml.Nif.xml_pattern_stream_file/4, path, patterns, opts)
+  end
+
+  def extract_memory(contents, patterns, opts \\ []) do
+    stream_memory(contents, patterns, opts) |> Enum.to_list()
+  end
+
+  def extract_file(path, patterns, opts \\ []) do
+    stream_file(path, patterns, opts) |> Enum.to_list()
+  end
+
+  defp stream(new, input, patterns, opts) do
+    namespaces =
+      opts
+      |> Keyword.get(:namespaces, [])
+      |> Enum.flat_map(fn {prefix, uri} -> [uri, to_string(prefix)] end)
+
+    output =
+      case Keyword.get(opts, :output, :text) do
+        :text -> 0
+        :outer_xml -> 1
+      end
+
+    batch_size = Keyword.get(opts, :batch_size, 1000)
+
+    unless is_integer(batch_size) and batch_size > 0 do
+      raise ArgumentError, "batch_size must be a positive integer, got: #{inspect(batch_size)}"
+    end
+
+    names = List.to_tuple(patterns)
+
+    Stream.resource(
+      fn ->
+        {:ok, stream} = new.(input, patterns, namespaces, output)
+        stream
+      end,
+      fn stream ->
+        case Libxml.Nif.xml_pattern_stream_next(stream, batch_size) do
+          {:ok, []} ->
+            {:halt, stream}
+
+          {:ok, matches} ->
+            {Enum.map(matches, fn {index, value} -> {elem(names, index), value} end), stream}
+        end
+      end,
+      &Libxml.Nif.xml_pattern_stream_close/1
+    )
+  end
+end
@@ -0,0 +1,65 @@
+defmodule Libxml.RelaxNG do
+  # Parser contexts, compiled grammars and validation contexts are NIF
+  # resources, freed when the last process referencing them lets go. A
+  # grammar can be cached and shared; a validation context keeps its grammar
+  # alive and validates one document at a time.
+  defstruct [:resource]
+
+  defmodule ParserCtxt do
+    defstruct [:resource]
+  end
+
+  defmodule ValidCtxt do
+    defstruct [:resource]
+  end
+
+  def new_parser_ctxt(path) when is_binary(path) do
+    {:ok, ctxt} = Libxml.Nif.xml_relaxng_new_parser_ctxt(path)
+    %ParserCtxt{resource: ctxt}
+  end
+
+  def new_doc_parser_ctxt(%Libxml.Node{} = doc) do
+    {:ok, ctxt} = Libxml.Nif.xml_relaxng_new_doc_parser_ctxt(doc.pointer)
+    %ParserCtxt{resource: ctxt}
+  end
+
+  # Returns {schema, errors}, schema is nil when the grammar is invalid.
+  def parse(%ParserCtxt{} = ctxt) do
+    Libxml.Telemetry.span(:relaxng_parse, %{}, fn ->
+      {:ok, {schema, errors}} = Libxml.Nif.xml_relaxng_parse(ctxt.resource)
+      errors = Enum.map(errors, &Libxml.Error.from_map/1)
+      {{schema_value(schema), errors}, %{error_count: length(errors)}}
+    end)
+  end
+
+  def parse_memory(buffer) when is_binary(buffer) do
+    Libxml.Telemetry.span(:relaxng_parse, %{}, fn ->
+      {:ok, {schema, errors}} = Libxml.Nif.xml_relaxng_parse_memory(buffer)
+      errors = Enum.map(errors, &Libxml.Error.from_map/1)
+      {{schema_value(schema), errors}, %{error_count: length(errors)}}
+    end)
+  end
+
+  def new_valid_ctxt(%__MODULE__{} = schema) do
+    {:ok, ctxt} = Libxml.Nif.xml_relaxng_new_valid_ctxt(schema.resource)
+    %ValidCtxt{resource: ctxt}
+  end
+
+  def validate_doc(%ValidCtxt{} = ctxt, %Libxml.Node{} = doc) do
+    {ret, errors} =
+      Libxml.Telemetry.span(:relaxng_validate, %{}, fn ->
+        {:ok, {ret, errors}} = Libxml.Nif.xml_relaxng_validate_doc(ctxt.resource, doc.pointer)
+        errors = Enum.map(errors, &Libxml.Error.from_map/1)
+        {{ret, errors}, %{error_count: length(errors)}}
+      end)
+
+    if ret == 0 do
+      {:ok, errors}
+    else
+      {:error, errors}
+    end
+  end
+
+  defp schema_value(nil), do: nil
+  defp schema_value(resource), do: %__MODULE__{resource: resource}
+end
@@ -0,0 +1,23 @@
+defmodule Libxml.Resolver do
+  # Resources registered here are served from memory whenever libxml2 loads
+  # the same URI, e.g. xs:include/xs:import targets of a schema. The store is
+  # global to the VM.
+
+  def register(uri, content) when is_binary(uri) and is_binary(content) do
+    :ok = Libxml.Nif.xml_register_resource(uri, content)
+  end
+
+  def unregister(uri) when is_binary(uri) do
+    :ok = Libxml.Nif.xml_unregister_resource(uri)
+  end
+
+  def clear() do
+    :ok = Libxml.Nif.xml_clear_resources()
+  end
+
+  # While blocked, http:// and ftp:// URIs that are not registered fail to
+  # load instead of being fetched.
+  def block_network(blocked) when is_boolean(blocked) do
+    :ok = Libxml.Nif.xml_set_network_blocked(if blocked, do: 1, else: 0)
+  end
+end
@@ -20,10 +20,19 @@ defmodule Libxml.Schema do
   end
 
   def parse(%ParserCtxt{} = ctxt) do
-    {:ok, {schema, errors}} = Libxml.Nif.xml_schema_parse(ctxt.pointer)
-    errors = Enum.map(errors, &Libxml.Error.from_map/1)
+    Libxml.Telemetry.span(:schema_parse, %{}, fn ->
+      {:ok, {schema, errors}} = Libxml.Nif.xml_schema_parse(ctxt.pointer)
+      errors = Enum.map(errors, &Libxml.Error.from_map/1)
+      {{%__MODULE__{pointer: schema}, errors}, %{error_count: length(errors)}}
+    end)
+  end
 
-    {%__MODULE__{pointer: schema}, errors}
+  def parse_memory(buffer) when is_binary(buffer) do
+    Libxml.Telemetry.span(:schema_parse, %{}, fn ->
+      {:ok, {schema, errors}} = Libxml.Nif.xml_schema_parse_memory(buffer)
+      errors = Enum.map(errors, &Libxml.Error.from_map/1)
+      {{%__MODULE__{pointer: schema}, errors}, %{error_count: length(errors)}}
+    end)
   end
 
   def new_valid_ctxt(%__MODULE__{} = schema) do
@@ -32,8 +41,12 @@ defmodule Libxml.Schema do
   end
 
   def validate_doc(%ValidCtxt{} = ctxt, %Libxml.Node{} = doc) do
-    {:ok, {ret, errors}} = Libxml.Nif.xml_schema_validate_doc(ctxt.pointer, doc.pointer)
-    errors = Enum.map(errors, &Libxml.Error.from_map/1)
+    {ret, errors} =
+      Libxml.Telemetry.span(:schema_validate, %{}, fn ->
+        {:ok, {ret, errors}} = Libxml.Nif.xml_schema_validate_doc(ctxt.pointer, doc.pointer)
+        errors = Enum.map(errors, &Libxml.Error.from_map/1)
+        {{ret, errors}, %{error_count: length(errors)}}
+      end)
 
     if ret == 0 do
       {:ok, errors}
@@ -77,9 +90,19 @@ defmodule Libxml.Schema do
   end
 
   def safe_parse(%ParserCtxt{} = ctxt, fun) do
-    {:ok, {schema, errors}} = Libxml.Nif.xml_schema_parse(ctxt.pointer)
-    schema = %__MODULE__{pointer: schema}
-    errors = Enum.map(errors, &Libxml.Error.from_map/1)
+    {schema, errors} = parse(ctxt)
+
+    try do
+      fun.(schema, errors)
+    after
+      if schema.pointer != 0 do
+        free(schema)
+      end
+    end
+  end
+
+  def safe_parse_memory(buffer, fun) when is_binary(buffer) do
+    {schema, errors} = parse_memory(buffer)
 
     try do
       fun.(schema, errors)
@@ -0,0 +1,27 @@
+defmodule Libxml.Snapshot do
+  # A compact binary image of a parsed document that restores much faster
+  # than re-parsing the XML, e.g. for reference documents kept in ETS or on
+  # disk. Elements, attributes, namespaces, text, CDATA, comments and
+  # processing instructions are kept; DTDs are not.
+
+  def dump(%Libxml.Node{pointer: pointer}) do
+    {:ok, snapshot} = Libxml.Nif.xml_doc_to_snapshot(pointer)
+    snapshot
+  end
+
+  # Raises on snapshots that are truncated, corrupt or not snapshots at all.
+  def load(snapshot) when is_binary(snapshot) do
+    {:ok, pointer} = Libxml.Nif.xml_doc_from_snapshot(snapshot)
+    %Libxml.Node{pointer: pointer}
+  end
+
+  def safe_load(snapshot, fun) when is_binary(snapshot) do
+    doc = load(snapshot)
+
+    try do
+      fun.(doc)
+    after
+      Libxml.free_doc(doc)
+    end
+  end
+end
@@ -0,0 +1,31 @@
+defmodule Libxml.Telemetry do
+  # Every wrapped operation runs inside :telemetry.span/3, which emits
+  #
+  #   [:libxml, operation, :start]
+  #   [:libxml, operation, :stop]
+  #   [:libxml, operation, :exception]
+  #
+  # with the standard span measurements, where operation is one of
+  # :read_memory, :read_file, :xpath_eval, :schema_parse, :schema_validate,
+  # :relaxng_parse, :relaxng_validate, :dtd_parse, :dtd_validate, :c14n and
+  # :xslt_transform. Stop metadata also carries whichever of :bytes,
+  # :node_count and :error_count apply to the operation.
+
+  def span(operation, metadata, fun) do
+    :telemetry.span([:libxml, operation], metadata, fn ->
+      {result, stop_metadata} = fun.()
+      {result, Map.merge(metadata, stop_metadata)}
+    end)
+  end
+
+  # Cumulative calls, errors, time_ns and bytes per operation, counted inside
+  # the NIFs regardless of whether the wrappers are used.
+  def stats() do
+    {:ok, stats} = Libxml.Nif.get_stats()
+    stats
+  end
+
+  def reset_stats() do
+    :ok = Libxml.Nif.reset_stats()
+  end
+end
@@ -39,6 +39,39 @@ defmodule Libxml.XPath do
         nodes: nodes
       }
     end
+
+    # Returns up to count nodes starting at offset without touching the rest
+    # of the set. as is :node (Libxml.Node structs), :text (string values),
+    # :attributes ([{name, value}] per node) or :term (subtrees in the
+    # Libxml.new_doc_tree/2 format).
+    def page(%__MODULE__{pointer: pointer}, offset, count, as \\ :node) do
+      {:ok, nodes} = Libxml.Nif.get_xml_node_set_page(pointer, offset, count, as_value(as))
+
+      case as do
+        :node -> Enum.map(nodes, &%Libxml.Node{pointer: &1})
+        _ -> nodes
+      end
+    end
+
+    # Lazily pages through the set. Like the node set itself, the stream is
+    # only valid until the XPath object is freed.
+    def stream(%__MODULE__{} = nodeset, as \\ :node, page_size \\ 1000) do
+      Stream.resource(
+        fn -> 0 end,
+        fn offset ->
+          case page(nodeset, offset, page_size, as) do
+            [] -> {:halt, offset}
+            nodes -> {nodes, offset + length(nodes)}
+          end
+        end,
+        fn _ -> :ok end
+      )
+    end
+
+    defp as_value(:node), do: 0
+    defp as_value(:text), do: 1
+    defp as_value(:attributes), do: 2
+    defp as_value(:term), do: 3
   end
 
   defmodule Object do
@@ -102,8 +135,17 @@ defmodule Libxml.XPath do
   end
 
   def eval(%Libxml.XPath.Context{pointer: pointer}, xpath) do
-    {:ok, pointer} = Libxml.Nif.xml_xpath_eval(pointer, xpath)
-    %Libxml.XPath.Object{pointer: pointer}
+    Libxml.Telemetry.span(:xpath_eval, %{xpath: xpath}, fn ->
+      {:ok, pointer} = Libxml.Nif.xml_xpath_eval(pointer, xpath)
+      {%Libxml.XPath.Object{pointer: pointer}, %{node_count: node_count(pointer)}}
+    end)
+  end
+
+  defp node_count(pointer) do
+    case Libxml.Nif.get_xml_xpath_object(pointer) do
+      {:ok, %{type: 1, node_nr: node_nr}} -> node_nr
+      _ -> 0
+    end
   end
 
   def free_object(%Libxml.XPath.Object{pointer: pointer}) do
@@ -0,0 +1,58 @@
+defmodule Libxml.XSLT do
+  defstruct [:resource]
+
+  # A compiled stylesheet is held by a NIF resource. It can be applied to any
+  # number of documents, from any number of processes, and is freed when the
+  # last process referencing it lets go, so there is no free/1. Parsing and
+  # transforming run on dirty schedulers.
+  #
+  # Stylesheets may read local files through document(), but writing files,
+  # creating directories and network access are forbidden.
+
+  def parse_stylesheet(contents) when is_binary(contents) do
+    {:ok, resource} = Libxml.Nif.xslt_parse_stylesheet(contents)
+    %__MODULE__{resource: resource}
+  end
+
+  # The document is copied, the caller still owns and frees it.
+  def parse_stylesheet_doc(%Libxml.Node{pointer: pointer}) do
+    {:ok, resource} = Libxml.Nif.xslt_parse_stylesheet_doc(pointer)
+    %__MODULE__{resource: resource}
+  end
+
+  # params are {name, value} pairs. Values are XPath expressions, so string
+  # values have to be quoted, e.g. {"title", "'Catalog'"}.
+  def apply_stylesheet(%__MODULE__{} = style, %Libxml.Node{} = doc, params \\ []) do
+    Libxml.Telemetry.span(:xslt_transform, %{}, fn ->
+      {:ok, pointer} =
+        Libxml.Nif.xslt_apply_stylesheet(style.resource, doc.pointer, params_value(params))
+
+      {%Libxml.Node{pointer: pointer}, %{}}
+    end)
+  end
+
+  # Applies the stylesheet and returns the result serialized as its
+  # xsl:output element specifies, without creating a result document handle.
+  def transform(%__MODULE__{} = style, %Libxml.Node{} = doc, params \\ []) do
+    Libxml.Telemetry.span(:xslt_transform, %{}, fn ->
+      {:ok, content} =
+        Libxml.Nif.xslt_transform(style.resource, doc.pointer, params_value(params))
+
+      {content, %{bytes: byte_size(content)}}
+    end)
+  end
+
+  def safe_apply_stylesheet(%__MODULE__{} = style, %Libxml.Node{} = doc, params \\ [], fun) do
+    result = apply_stylesheet(style, doc, params)
+
+    try do
+      fun.(result)
+    after
+      Libxml.free_doc(result)
+    end
+  end
+
+  defp params_value(params) do
+    Enum.flat_map(params, fn {name, value} -> [to_string(name), value] end)
+  end
+end
@@ -24,7 +24,8 @@ defmodule Libxml.Mixfile do
         ]
       ],
       start_permanent: Mix.env() == :prod,
-      deps: deps()
+      deps: deps(),
+      aliases: aliases()
     ]
   end
 
@@ -35,7 +36,15 @@ defmodule Libxml.Mixfile do
   end
 
   defp deps do
-    [{:ex_doc, "~> 0.22.2", only: :dev, runtime: false}]
+    [
+      {:telemetry, "~> 0.4.2 or ~> 1.0"},
+      {:ex_doc, "~> 0.22.2", only: :dev, runtime: false},
+      {:benchee, "~> 1.1", only: :dev}
+    ]
+  end
+
+  defp aliases do
+    [bench: "run bench/run.exs"]
   end
 end
 
@@ -1,9 +1,26 @@
 #include "erl_nif.h"
 
 #include <libxml/parser.h>
+#include <libxml/parserInternals.h>
 #include <libxml/tree.h>
 #include <libxml/c14n.h>
 #include <libxml/xmlschemas.h>
+#include <libxml/relaxng.h>
+#include <libxml/valid.h>
+#include <libxml/hash.h>
+#include <libxml/xpathInternals.h>
+#include <libxml/xmlreader.h>
+#include <libxml/pattern.h>
+#include <libxslt/xslt.h>
+#include <libxslt/xsltInternals.h>
+#include <libxslt/transform.h>
+#include <libxslt/imports.h>
+#include <libxslt/xsltutils.h>
+#include <libxslt/security.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <string.h>
 #include <assert.h>
 
@@ -64,6 +81,13 @@ static ERL_NIF_TERM make_ok(ErlNifEnv* env, ERL_NIF_TERM value) {
     NAME = (TYPE)intptr; \
   }
 
+// TYPE is the resource struct, registered in load() as TYPE##_type
+#define GET_RESOURCE(TYPE, NAME, VALUE) \
+  TYPE* NAME; \
+  if (!enif_get_resource(env, VALUE, TYPE##_type, (void**)&NAME)) { \
+    return enif_make_badarg(env); \
+  }
+
 // Eterm to Integer
 #define GET_INT(NAME, VALUE) \
   int NAME; \
@@ -123,10 +147,98 @@ static ERL_NIF_TERM make_ok(ErlNifEnv* env, ERL_NIF_TERM value) {
   if (enif_make_map_put(env, MAP, enif_make_atom(env, #NAME), NAME, &MAP) == 0) \
     return make_error(env, "failed_to_map_put")
 
+// Cumulative counters per operation, readable through get_stats/0.
+// Updated with atomic adds since NIFs run concurrently on many schedulers.
+typedef enum {
+  STATS_READ_MEMORY,
+  STATS_READ_FILE,
+  STATS_XPATH_EVAL,
+  STATS_SCHEMA_PARSE,
+  STATS_SCHEMA_VALIDATE,
+  STATS_RELAXNG_PARSE,
+  STATS_RELAXNG_VALIDATE,
+  STATS_DTD_PARSE,
+  STATS_DTD_VALIDATE,
+  STATS_C14N,
+  STATS_XSLT_TRANSFORM,
+  STATS_COUNT
+} stats_op;
+
+static const char* stats_names[STATS_COUNT] = {
+  "read_memory",
+  "read_file",
+  "xpath_eval",
+  "schema_parse",
+  "schema_validate",
+  "relaxng_parse",
+  "relaxng_validate",
+  "dtd_parse",
+  "dtd_validate",
+  "c14n",
+  "xslt_transform",
+};
+
+typedef struct {
+  ErlNifUInt64 calls;
+  ErlNifUInt64 errors;
+  ErlNifUInt64 time_ns;
+  ErlNifUInt64 bytes;
+} op_stats;
+
+static op_stats stats[STATS_COUNT];
+
+#define STATS_START(NAME) \
+  ErlNifTime NAME = enif_monotonic_time(ERL_NIF_NSEC)
+
+static void stats_record(stats_op op, ErlNifTime start, ErlNifUInt64 bytes, int failed) {
+  ErlNifTime elapsed = enif_monotonic_time(ERL_NIF_NSEC) - start;
+  __atomic_fetch_add(&stats[op].calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats[op].errors, failed ? 1 : 0, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats[op].time_ns, (ErlNifUInt64)elapsed, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats[op].bytes, bytes, __ATOMIC_RELAXED);
+}
+
 static ERL_NIF_TERM xml_read_memory(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
   GET_BINARY(content, argv[0]);
 
+  STATS_START(start);
   xmlDocPtr doc = xmlReadMemory((const char*)content.data, content.size, "noname.xml", NULL, 0);
+  stats_record(STATS_READ_MEMORY, start, content.size, doc == NULL);
+  if (doc == NULL) {
+    return make_error(env, "failed_to_parse_document");
+  }
+
+  SET_POINTER(ptr, doc);
+
+  return make_ok(env, ptr);
+}
+// Parses straight from disk with libxml2's own buffered reader, so the file
+// content never has to be loaded into a BEAM binary first.
+static ERL_NIF_TERM xml_read_file(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(path, argv[0]);
+
+  char* pathstr = (char*)xmlMalloc(path.size + 1);
+  if (pathstr == NULL) {
+    return make_error(env, "malloc_failed");
+  }
+  memcpy(pathstr, path.data, path.size);
+  pathstr[path.size] = '\0';
+
+  STATS_START(start);
+  // open the file ourselves: xmlReadFile would also fetch http:// and ftp://
+  // URLs, and this is a local file API
+  xmlDocPtr doc = NULL;
+  ErlNifUInt64 size = 0;
+  int fd = open(pathstr, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    size = fstat(fd, &st) == 0 ? (ErlNifUInt64)st.st_size : 0;
+    // the path is still the base URL for relative DTDs and includes
+    doc = xmlReadFd(fd, pathstr, NULL, 0);
+    close(fd);
+  }
+  xmlFree(pathstr);
+  stats_record(STATS_READ_FILE, start, size, doc == NULL);
   if (doc == NULL) {
     return make_error(env, "failed_to_parse_document");
   }
@@ -135,6 +247,7 @@ static ERL_NIF_TERM xml_read_memory(ErlNifEnv *env, int argc, const ERL_NIF_TERM
 
   return make_ok(env, ptr);
 }
+
 static ERL_NIF_TERM xml_copy_doc(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
   GET_POINTER(xmlDocPtr, doc, argv[0]);
   if (doc->type != XML_DOCUMENT_NODE) {
@@ -236,6 +349,110 @@ static ERL_NIF_TERM xml_get_prop(ErlNifEnv *env, int argc, const ERL_NIF_TERM ar
   return make_ok(env, enif_make_binary(env, &bin));
 }
 
+static xmlChar* binary_to_xml_char(const ErlNifBinary* bin) {
+  xmlChar* str = (xmlChar*)xmlMalloc(bin->size + 1);
+  if (str == NULL) {
+    return NULL;
+  }
+  memcpy(str, bin->data, bin->size);
+  str[bin->size] = '\0';
+  return str;
+}
+
+// deeper terms are rejected instead of overflowing the C stack
+#define MAX_TREE_DEPTH 1024
+
+// Builds a node owned by doc from one of:
+//   {name, [{attr_name, attr_value}], children}  -> element node
+//   binary                                       -> text node
+// Returns NULL on bad input or allocation failure; nothing is leaked.
+static xmlNodePtr term_to_xml_node(ErlNifEnv* env, xmlDocPtr doc, ERL_NIF_TERM term, int depth) {
+  if (depth > MAX_TREE_DEPTH) {
+    return NULL;
+  }
+
+  ErlNifBinary bin;
+  if (enif_inspect_binary(env, term, &bin)) {
+    return xmlNewDocTextLen(doc, bin.data, bin.size);
+  }
+
+  int arity;
+  const ERL_NIF_TERM* elems;
+  if (!enif_get_tuple(env, term, &arity, &elems) || arity != 3 ||
+      !enif_is_list(env, elems[1]) || !enif_is_list(env, elems[2])) {
+    return NULL;
+  }
+
+  if (!enif_inspect_binary(env, elems[0], &bin)) {
+    return NULL;
+  }
+  xmlChar* name = binary_to_xml_char(&bin);
+  if (name == NULL) {
+    return NULL;
+  }
+  xmlNodePtr node = xmlNewDocNode(doc, NULL, name, NULL);
+  xmlFree(name);
+  if (node == NULL) {
+    return NULL;
+  }
+
+  ERL_NIF_TERM head;
+  ERL_NIF_TERM list = elems[1];
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    const ERL_NIF_TERM* attr;
+    ErlNifBinary attr_name;
+    ErlNifBinary attr_value;
+    if (!enif_get_tuple(env, head, &arity, &attr) || arity != 2 ||
+        !enif_inspect_binary(env, attr[0], &attr_name) ||
+        !enif_inspect_binary(env, attr[1], &attr_value)) {
+      xmlFreeNode(node);
+      return NULL;
+    }
+
+    xmlChar* namestr = binary_to_xml_char(&attr_name);
+    xmlChar* valuestr = binary_to_xml_char(&attr_value);
+    xmlAttrPtr prop = NULL;
+    if (namestr != NULL && valuestr != NULL) {
+      prop = xmlNewProp(node, namestr, valuestr);
+    }
+    xmlFree(namestr);
+    xmlFree(valuestr);
+    if (prop == NULL) {
+      xmlFreeNode(node);
+      return NULL;
+    }
+  }
+
+  list = elems[2];
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    xmlNodePtr child = term_to_xml_node(env, doc, head, depth + 1);
+    if (child == NULL) {
+      xmlFreeNode(node);
+      return NULL;
+    }
+    // adjacent text children are merged into the existing node and freed
+    xmlAddChild(node, child);
+  }
+
+  return node;
+}
+
+static ERL_NIF_TERM xml_new_doc_tree(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
+  }
+
+  xmlNodePtr node = term_to_xml_node(env, doc, argv[1], 0);
+  if (node == NULL) {
+    return make_error(env, "failed_to_new_doc_tree");
+  }
+
+  SET_POINTER(ptr, node);
+
+  return make_ok(env, ptr);
+}
+
 static ERL_NIF_TERM xml_new_ns(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
   GET_POINTER(xmlNodePtr, node, argv[0]);
   GET_BINARY(href, argv[1]);
@@ -315,63 +532,77 @@ static void free_xml_char_pp(xmlChar** pp, unsigned int len) {
   xmlFree(pp);
 }
 
-static ERL_NIF_TERM xml_c14n_doc_dump_memory(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlDocPtr, doc, argv[0]);
-  if (doc->type != XML_DOCUMENT_NODE) {
-    return enif_make_badarg(env);
-  }
-  GET_POINTER_OR_NULL(xmlNodeSetPtr, nodeset, argv[1]);
-  GET_INT(mode, argv[2]);
+// Eterm(list of binary) to NULL terminated xmlChar* array.
+// An empty list yields NULL. Returns an error reason, or NULL on success.
+static const char* get_xml_char_pp(ErlNifEnv* env, ERL_NIF_TERM list, xmlChar*** pp, unsigned int* pplen) {
+  int ret;
 
-  xmlChar** inclusive_ns_prefixes = NULL;
-  unsigned int inclusive_ns_prefixes_length;
-  {
-    ERL_NIF_TERM list = argv[3];
-    int ret;
+  *pp = NULL;
+  *pplen = 0;
 
-    unsigned int len = 0;
-    ret = enif_get_list_length(env, list, &len);
-    if (ret == 0) {
-      return make_error(env, "failed_to_get_list_length");
-    }
-    inclusive_ns_prefixes_length = len;
+  unsigned int len = 0;
+  ret = enif_get_list_length(env, list, &len);
+  if (ret == 0) {
+    return "failed_to_get_list_length";
+  }
+  if (len == 0) {
+    return NULL;
+  }
 
-    if (len != 0) {
-      inclusive_ns_prefixes = (xmlChar**)xmlMalloc((len + 1) * sizeof(xmlChar*));
-      for (int i = 0; i < len; i++) {
-        inclusive_ns_prefixes[i] = NULL;
-      }
-      inclusive_ns_prefixes[len] = NULL;
+  xmlChar** strs = (xmlChar**)xmlMalloc((len + 1) * sizeof(xmlChar*));
+  if (strs == NULL) {
+    return "failed_to_malloc";
+  }
+  for (int i = 0; i <= len; i++) {
+    strs[i] = NULL;
+  }
 
-      for (int i = 0; i < len; i++) {
-        ERL_NIF_TERM head;
-        ret = enif_get_list_cell(env, list, &head, &list);
-        assert(ret != 0);
+  for (int i = 0; i < len; i++) {
+    ERL_NIF_TERM head;
+    ret = enif_get_list_cell(env, list, &head, &list);
+    assert(ret != 0);
 
-        ErlNifBinary bin;
-        ret = enif_inspect_binary(env, head, &bin);
-        if (ret == 0) {
-          free_xml_char_pp(inclusive_ns_prefixes, len);
-          return make_error(env, "failed_to_inspect_binary");
-        }
+    ErlNifBinary bin;
+    ret = enif_inspect_binary(env, head, &bin);
+    if (ret == 0) {
+      free_xml_char_pp(strs, len);
+      return "failed_to_inspect_binary";
+    }
 
-        inclusive_ns_prefixes[i] = (xmlChar*)xmlMalloc(bin.size + 1);
-        if (inclusive_ns_prefixes[i] == NULL) {
-          free_xml_char_pp(inclusive_ns_prefixes, len);
-          return make_error(env, "failed_to_malloc");
-        }
-        memcpy(inclusive_ns_prefixes[i], bin.data, bin.size);
-        inclusive_ns_prefixes[i][bin.size] = '\0';
-      }
+    strs[i] = binary_to_xml_char(&bin);
+    if (strs[i] == NULL) {
+      free_xml_char_pp(strs, len);
+      return "failed_to_malloc";
     }
   }
 
+  *pp = strs;
+  *pplen = len;
+  return NULL;
+}
+
+static ERL_NIF_TERM xml_c14n_doc_dump_memory(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
+  }
+  GET_POINTER_OR_NULL(xmlNodeSetPtr, nodeset, argv[1]);
+  GET_INT(mode, argv[2]);
   GET_INT(with_comments, argv[4]);
 
+  xmlChar** inclusive_ns_prefixes;
+  unsigned int inclusive_ns_prefixes_length;
+  const char* reason = get_xml_char_pp(env, argv[3], &inclusive_ns_prefixes, &inclusive_ns_prefixes_length);
+  if (reason != NULL) {
+    return make_error(env, reason);
+  }
+
   int ret;
 
   xmlChar* output;
+  STATS_START(start);
   ret = xmlC14NDocDumpMemory(doc, nodeset, mode, inclusive_ns_prefixes, with_comments, &output);
+  stats_record(STATS_C14N, start, ret < 0 ? 0 : ret, ret < 0);
   free_xml_char_pp(inclusive_ns_prefixes, inclusive_ns_prefixes_length);
   if (ret < 0) {
     return make_error(env, "failed_to_c14n_dump_memory");
@@ -389,585 +620,3235 @@ static ERL_NIF_TERM xml_c14n_doc_dump_memory(ErlNifEnv *env, int argc, const ERL
   return make_ok(env, enif_make_binary(env, &bin));
 }
 
-static ERL_NIF_TERM xml_xpath_new_context(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlDocPtr, doc, argv[0]);
-  if (doc->type != XML_DOCUMENT_NODE) {
-    return enif_make_badarg(env);
+// SHA-256 (FIPS 180-4), used to fingerprint documents without materializing
+// the canonical form.
+#define SHA256_DIGEST_LENGTH 32
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t length;
+  unsigned char block[64];
+  size_t block_len;
+} sha256_ctx;
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(sha256_ctx* ctx, const unsigned char* data) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+           ((uint32_t)data[i * 4 + 2] << 8) | (uint32_t)data[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
   }
 
-  xmlXPathContextPtr ctx = xmlXPathNewContext(doc);
-  if (ctx == NULL) {
-    return make_error(env, "xpath_new_context");
+  uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+  uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+    uint32_t s0 = SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
   }
+  ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+  ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
 
-  SET_POINTER(ptr, ctx);
+static void sha256_init(sha256_ctx* ctx) {
+  static const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(ctx->state, init, sizeof(init));
+  ctx->length = 0;
+  ctx->block_len = 0;
+}
 
-  return make_ok(env, ptr);
+static void sha256_update(sha256_ctx* ctx, const unsigned char* data, size_t len) {
+  ctx->length += len;
+  while (len > 0) {
+    size_t n = 64 - ctx->block_len;
+    if (n > len) n = len;
+    memcpy(ctx->block + ctx->block_len, data, n);
+    ctx->block_len += n;
+    data += n;
+    len -= n;
+    if (ctx->block_len == 64) {
+      sha256_transform(ctx, ctx->block);
+      ctx->block_len = 0;
+    }
+  }
 }
-static ERL_NIF_TERM xml_xpath_free_context(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlXPathContextPtr, ctx, argv[0]);
 
-  xmlXPathFreeContext(ctx);
+static void sha256_final(sha256_ctx* ctx, unsigned char* digest) {
+  uint64_t bits = ctx->length * 8;
+  unsigned char pad = 0x80;
+  sha256_update(ctx, &pad, 1);
+  pad = 0;
+  while (ctx->block_len != 56) {
+    sha256_update(ctx, &pad, 1);
+  }
+  unsigned char lenbuf[8];
+  for (int i = 0; i < 8; i++) {
+    lenbuf[i] = (unsigned char)(bits >> (56 - i * 8));
+  }
+  sha256_update(ctx, lenbuf, 8);
+  for (int i = 0; i < 8; i++) {
+    digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+    digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+    digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+    digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+  }
+}
 
-  return enif_make_atom(env, "ok");
+// xmlOutputBuffer write callback feeding the hash instead of a memory buffer
+static int sha256_output_write(void* context, const char* buffer, int len) {
+  sha256_update((sha256_ctx*)context, (const unsigned char*)buffer, len);
+  return len;
 }
 
-static ERL_NIF_TERM xml_xpath_eval(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlXPathContextPtr, ctx, argv[0]);
-  GET_BINARY(strbin, argv[1]);
+static void sha256_update_length_prefixed(sha256_ctx* ctx, const xmlChar* str) {
+  size_t len = str == NULL ? 0 : strlen((const char*)str);
+  unsigned char lenbuf[4] = {
+    (unsigned char)(len >> 24), (unsigned char)(len >> 16), (unsigned char)(len >> 8), (unsigned char)len,
+  };
+  sha256_update(ctx, lenbuf, 4);
+  sha256_update(ctx, str, len);
+}
 
-  xmlChar* xpath = (xmlChar*)xmlMalloc(strbin.size + 1);
-  if (xpath == NULL) {
-    return make_error(env, "malloc_failed");
+static ERL_NIF_TERM make_sha256_digest(ErlNifEnv* env, sha256_ctx* ctx) {
+  ERL_NIF_TERM digest;
+  unsigned char* buf = enif_make_new_binary(env, SHA256_DIGEST_LENGTH, &digest);
+  sha256_final(ctx, buf);
+  return digest;
+}
+
+static ERL_NIF_TERM xml_c14n_doc_digest(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
   }
-  memcpy(xpath, strbin.data, strbin.size);
-  xpath[strbin.size] = '\0';
+  GET_POINTER_OR_NULL(xmlNodeSetPtr, nodeset, argv[1]);
+  GET_INT(mode, argv[2]);
+  GET_INT(with_comments, argv[4]);
 
-  xmlXPathObjectPtr obj = xmlXPathEval(xpath, ctx);
-  xmlFree(xpath);
-  if (obj == NULL) {
-    return make_error(env, "xpath_eval");
+  xmlChar** inclusive_ns_prefixes;
+  unsigned int inclusive_ns_prefixes_length;
+  const char* reason = get_xml_char_pp(env, argv[3], &inclusive_ns_prefixes, &inclusive_ns_prefixes_length);
+  if (reason != NULL) {
+    return make_error(env, reason);
   }
 
-  SET_POINTER(ptr, obj);
+  sha256_ctx sha;
+  sha256_init(&sha);
 
-  return make_ok(env, ptr);
+  xmlOutputBufferPtr buf = xmlOutputBufferCreateIO(sha256_output_write, NULL, &sha, NULL);
+  if (buf == NULL) {
+    free_xml_char_pp(inclusive_ns_prefixes, inclusive_ns_prefixes_length);
+    return make_error(env, "failed_to_create_output_buffer");
+  }
+
+  STATS_START(start);
+  int ret = xmlC14NDocSaveTo(doc, nodeset, mode, inclusive_ns_prefixes, with_comments, buf);
+  free_xml_char_pp(inclusive_ns_prefixes, inclusive_ns_prefixes_length);
+  int close_ret = xmlOutputBufferClose(buf);
+  stats_record(STATS_C14N, start, close_ret < 0 ? 0 : close_ret, ret < 0 || close_ret < 0);
+  if (ret < 0 || close_ret < 0) {
+    return make_error(env, "failed_to_c14n_digest");
+  }
+
+  return make_ok(env, make_sha256_digest(env, &sha));
 }
-static ERL_NIF_TERM xml_xpath_free_object(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlXPathObjectPtr, p, argv[0]);
 
-  xmlXPathFreeObject(p);
+// xmlOutputBuffer write callback appending to an ErlNifBinary, so C14N output
+// lands in the result binary without an intermediate xmlChar* copy.
+typedef struct {
+  ErlNifBinary bin;
+  size_t size;
+  int failed;
+} binary_output;
+
+static int binary_output_write(void* context, const char* buffer, int len) {
+  binary_output* out = (binary_output*)context;
+  if (out->size + len > out->bin.size) {
+    size_t capacity = out->bin.size * 2;
+    while (capacity < out->size + len) {
+      capacity *= 2;
+    }
+    if (!enif_realloc_binary(&out->bin, capacity)) {
+      out->failed = 1;
+      return -1;
+    }
+  }
+  memcpy(out->bin.data + out->size, buffer, len);
+  out->size += len;
+  return len;
+}
 
-  return enif_make_atom(env, "ok");
+// The selected roots, sorted by address so membership is a binary search,
+// plus the visibility of the last element checked: C14N asks about every
+// attribute and namespace node of an element right after the element itself.
+typedef struct {
+  xmlNodePtr* roots;
+  int count;
+  xmlNodePtr last;
+  int last_visible;
+} c14n_subtrees;
+
+static int compare_node_ptr(const void* a, const void* b) {
+  uintptr_t x = (uintptr_t)*(const xmlNodePtr*)a;
+  uintptr_t y = (uintptr_t)*(const xmlNodePtr*)b;
+  return (x > y) - (x < y);
 }
 
-static ERL_NIF_TERM get_xml_node(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlNodePtr, node, argv[0]);
+// Visible if the node, or the element owning the attribute or namespace
+// node, lies in the subtree of one of the selected roots.
+static int c14n_is_in_subtrees(void* user_data, xmlNodePtr node, xmlNodePtr parent) {
+  c14n_subtrees* subtrees = (c14n_subtrees*)user_data;
+  xmlNodePtr start = node->type == XML_NAMESPACE_DECL ? parent : node;
+  int visible = 0;
+  for (xmlNodePtr cur = start; cur != NULL; cur = cur->parent) {
+    if (cur == subtrees->last) {
+      visible = subtrees->last_visible;
+      break;
+    }
+    if (bsearch(&cur, subtrees->roots, subtrees->count, sizeof(xmlNodePtr), compare_node_ptr) != NULL) {
+      visible = 1;
+      break;
+    }
+  }
+  if (start != NULL && start->type == XML_ELEMENT_NODE) {
+    subtrees->last = start;
+    subtrees->last_visible = visible;
+  }
+  return visible;
+}
 
-  //void           *_private;   /* application data */
-  //xmlElementType   type;      /* type number, must be second ! */
-  //const xmlChar   *name;      /* the name of the node, or the entity */
-  //struct _xmlNode *children;  /* parent->childs link */
-  //struct _xmlNode *last;      /* last child link */
-  //struct _xmlNode *parent;    /* child->parent link */
-  //struct _xmlNode *next;      /* next sibling link  */
-  //struct _xmlNode *prev;      /* previous sibling link  */
-  //struct _xmlDoc  *doc;       /* the containing document */
+static int attr_value_equals(xmlAttrPtr attr, const xmlChar* value) {
+  xmlNodePtr text = attr->children;
+  return text != NULL && text->next == NULL && text->type == XML_TEXT_NODE &&
+         xmlStrEqual(text->content, value);
+}
 
-  SET_POINTER_OR_NULL(private, node->_private);
-  SET_INT(type, node->type);
-  SET_POINTER_OR_NULL(name, node->name);
-  SET_POINTER_OR_NULL(children, node->children);
-  SET_POINTER_OR_NULL(last, node->last);
-  SET_POINTER_OR_NULL(parent, node->parent);
-  SET_POINTER_OR_NULL(next, node->next);
-  SET_POINTER_OR_NULL(prev, node->prev);
-  SET_POINTER_OR_NULL(doc, node->doc);
+// Resolves a same-document reference ("#id"). DTD declared IDs are used when
+// present; otherwise any Id, ID or id attribute (e.g. wsu:Id) matches.
+static xmlNodePtr find_element_by_id(xmlDocPtr doc, const xmlChar* id) {
+  xmlAttrPtr idattr = xmlGetID(doc, id);
+  if (idattr != NULL) {
+    return idattr->parent;
+  }
 
-  ERL_NIF_TERM map = enif_make_new_map(env);
+  xmlNodePtr cur = xmlDocGetRootElement(doc);
+  while (cur != NULL) {
+    if (cur->type == XML_ELEMENT_NODE) {
+      for (xmlAttrPtr attr = cur->properties; attr != NULL; attr = attr->next) {
+        if ((xmlStrEqual(attr->name, BAD_CAST "Id") || xmlStrEqual(attr->name, BAD_CAST "ID") ||
+             xmlStrEqual(attr->name, BAD_CAST "id")) &&
+            attr_value_equals(attr, id)) {
+          return cur;
+        }
+      }
+      if (cur->children != NULL) {
+        cur = cur->children;
+        continue;
+      }
+    }
+    while (cur != NULL && cur->next == NULL) {
+      cur = cur->parent;
+      if (cur == NULL || cur->type == XML_DOCUMENT_NODE) {
+        return NULL;
+      }
+    }
+    if (cur != NULL) {
+      cur = cur->next;
+    }
+  }
+  return NULL;
+}
 
-  PUT(map, private);
-  PUT(map, type);
-  PUT(map, name);
-  PUT(map, children);
-  PUT(map, last);
-  PUT(map, parent);
-  PUT(map, next);
-  PUT(map, prev);
-  PUT(map, doc);
+// Canonicalizes every reference of a signature in one call. Each reference is
+// "" (the whole document), "#id" (the subtree of the element with that ID) or
+// an XPath expression (the subtrees of the selected nodes). Returns either
+// the canonical bytes or their SHA-256 digests, in reference order.
+static ERL_NIF_TERM xml_c14n_references(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
+  }
+  unsigned int nrefs;
+  if (!enif_get_list_length(env, argv[1], &nrefs)) {
+    return enif_make_badarg(env);
+  }
+  GET_INT(mode, argv[2]);
+  GET_INT(with_comments, argv[4]);
+  GET_INT(digest, argv[5]);
 
-  switch (node->type) {
-  // special node types
-  case XML_ATTRIBUTE_NODE:
-    {
-      //xmlAttrPtr:
-      //xmlNs           *ns;        /* pointer to the associated namespace */
-      //xmlAttributeType atype;     /* the attribute type if validating */
-      //void            *psvi;      /* for type/PSVI informations */
-      return make_ok(env, map);
+  xmlChar** inclusive_ns_prefixes;
+  unsigned int inclusive_ns_prefixes_length;
+  const char* reason = get_xml_char_pp(env, argv[3], &inclusive_ns_prefixes, &inclusive_ns_prefixes_length);
+  if (reason != NULL) {
+    return make_error(env, reason);
+  }
+
+  xmlXPathContextPtr ctx = xmlXPathNewContext(doc);
+  if (ctx == NULL) {
+    free_xml_char_pp(inclusive_ns_prefixes, inclusive_ns_prefixes_length);
+    return make_error(env, "xpath_new_context");
+  }
+
+  // [uri, prefix, ...] for prefixes used in XPath references, e.g. wsu
+  xmlChar** namespaces;
+  unsigned int namespaces_length;
+  reason = get_xml_char_pp(env, argv[6], &namespaces, &namespaces_length);
+  if (reason != NULL) {
+    xmlXPathFreeContext(ctx);
+    free_xml_char_pp(inclusive_ns_prefixes, inclusive_ns_prefixes_length);
+    return make_error(env, reason);
+  }
+  for (unsigned int i = 0; i + 1 < namespaces_length; i += 2) {
+    if (xmlXPathRegisterNs(ctx, namespaces[i + 1], namespaces[i]) != 0) {
+      reason = "failed_to_register_namespace";
+      break;
     }
-  case XML_DTD_NODE:
-    {
-      //xmlDtdPtr:
-      //void          *notations;   /* Hash table for notations if any */
-      //void          *elements;    /* Hash table for elements if any */
-      //void          *attributes;  /* Hash table for attributes if any */
-      //void          *entities;    /* Hash table for entities if any */
-      //const xmlChar *ExternalID;  /* External identifier for PUBLIC DTD */
-      //const xmlChar *SystemID;    /* URI for a SYSTEM or PUBLIC DTD */
-      //void          *pentities;   /* Hash table for param entities if any */
-      return make_ok(env, map);
+  }
+  free_xml_char_pp(namespaces, namespaces_length);
+  if (reason != NULL) {
+    xmlXPathFreeContext(ctx);
+    free_xml_char_pp(inclusive_ns_prefixes, inclusive_ns_prefixes_length);
+    return make_error(env, reason);
+  }
+
+  ERL_NIF_TERM results = enif_make_list(env, 0);
+  ERL_NIF_TERM head;
+  ERL_NIF_TERM list = argv[1];
+  reason = NULL;
+  while (reason == NULL && enif_get_list_cell(env, list, &head, &list)) {
+    ErlNifBinary ref;
+    if (!enif_inspect_binary(env, head, &ref)) {
+      reason = "failed_to_inspect_binary";
+      break;
     }
-  case XML_ELEMENT_DECL:
-    {
-      //xmlElementPtr:
-      //xmlElementTypeVal      etype;   /* The type */
-      //xmlElementContentPtr content;   /* the allowed element content */
-      //xmlAttributePtr   attributes;   /* List of the declared attributes */
-      //const xmlChar        *prefix;   /* the namespace prefix if any */
-      return make_ok(env, map);
+    xmlChar* refstr = binary_to_xml_char(&ref);
+    if (refstr == NULL) {
+      reason = "malloc_failed";
+      break;
     }
-  case XML_ATTRIBUTE_DECL:
-    {
-      //xmlAttributePtr:
-      //struct _xmlAttribute  *nexth;   /* next in hash table */
-      //xmlAttributeType       atype;   /* The attribute type */
-      //xmlAttributeDefault      def;   /* the default */
-      //const xmlChar  *defaultValue;   /* or the default value */
-      //xmlEnumerationPtr       tree;       /* or the enumeration tree if any */
-      //const xmlChar        *prefix;   /* the namespace prefix if any */
-      //const xmlChar          *elem;   /* Element holding the attribute */
-      return make_ok(env, map);
+
+    xmlXPathObjectPtr obj = NULL;
+    xmlNodeSetPtr roots = NULL;
+    xmlNodeSetPtr owned_roots = NULL;
+    if (ref.size == 0) {
+      // whole document, every node visible
+    } else if (refstr[0] == '#') {
+      xmlNodePtr elem = find_element_by_id(doc, refstr + 1);
+      if (elem != NULL) {
+        roots = owned_roots = xmlXPathNodeSetCreate(elem);
+      }
+      if (roots == NULL) {
+        reason = "reference_not_found";
+      }
+    } else {
+      obj = xmlXPathEval(refstr, ctx);
+      if (obj == NULL || obj->type != XPATH_NODESET) {
+        reason = "xpath_eval";
+      } else if (obj->nodesetval == NULL || obj->nodesetval->nodeNr == 0) {
+        reason = "reference_not_found";
+      } else {
+        roots = obj->nodesetval;
+      }
     }
-  case XML_DOCUMENT_NODE:
-    {
-      //xmlDocPtr:
-      //int             compression;/* level of zlib compression */
-      //int             standalone; /* standalone document (no external refs) 
-      //                                 1 if standalone="yes"
-      //                                 0 if standalone="no"
-      //                                -1 if there is no XML declaration
-      //                                -2 if there is an XML declaration, but no
-      //                                    standalone attribute was specified */
-      //struct _xmlDtd  *intSubset; /* the document internal subset */
-      //struct _xmlDtd  *extSubset; /* the document external subset */
-      //struct _xmlNs   *oldNs;     /* Global namespace, the old way */
-      //const xmlChar  *version;    /* the XML version string */
-      //const xmlChar  *encoding;   /* external initial encoding, if any */
-      //void           *ids;        /* Hash table for ID attributes if any */
-      //void           *refs;       /* Hash table for IDREFs attributes if any */
-      //const xmlChar  *URL;        /* The URI for that document */
-      //int             charset;    /* encoding of the in-memory content
-      //                               actually an xmlCharEncoding */
-      //struct _xmlDict *dict;      /* dict used to allocate names or NULL */
-      //void           *psvi;       /* for type/PSVI informations */
-      //int             parseFlags; /* set of xmlParserOption used to parse the
-      //                               document */
-      //int             properties; /* set of xmlDocProperties for this document
-      //                               set at the end of parsing */
-      return make_ok(env, map);
+    xmlFree(refstr);
+
+    c14n_subtrees subtrees = { NULL, 0, NULL, 0 };
+    if (reason == NULL && roots != NULL) {
+      subtrees.count = roots->nodeNr;
+      subtrees.roots = (xmlNodePtr*)xmlMalloc(sizeof(xmlNodePtr) * subtrees.count);
+      if (subtrees.roots == NULL) {
+        reason = "malloc_failed";
+      } else {
+        memcpy(subtrees.roots, roots->nodeTab, sizeof(xmlNodePtr) * subtrees.count);
+        qsort(subtrees.roots, subtrees.count, sizeof(xmlNodePtr), compare_node_ptr);
+      }
+    }
+
+    if (reason == NULL) {
+      sha256_ctx sha;
+      binary_output out;
+      int allocated = 0;
+      xmlOutputBufferPtr buf = NULL;
+      if (digest) {
+        sha256_init(&sha);
+        buf = xmlOutputBufferCreateIO(sha256_output_write, NULL, &sha, NULL);
+      } else {
+        out.size = 0;
+        out.failed = 0;
+        allocated = enif_alloc_binary(4096, &out.bin);
+        if (allocated) {
+          buf = xmlOutputBufferCreateIO(binary_output_write, NULL, &out, NULL);
+        }
+      }
+
+      if (buf == NULL) {
+        reason = "failed_to_create_output_buffer";
+      } else {
+        int ret = xmlC14NExecute(doc, roots == NULL ? NULL : c14n_is_in_subtrees, &subtrees, mode,
+                                 inclusive_ns_prefixes, with_comments, buf);
+        int close_ret = xmlOutputBufferClose(buf);
+        if (ret < 0 || close_ret < 0) {
+          reason = "failed_to_c14n_references";
+        }
+      }
+
+      if (digest) {
+        if (reason == NULL) {
+          results = enif_make_list_cell(env, make_sha256_digest(env, &sha), results);
+        }
+      } else if (allocated) {
+        // a failed write leaves the original allocation in place
+        if (reason == NULL && !out.failed && enif_realloc_binary(&out.bin, out.size)) {
+          results = enif_make_list_cell(env, enif_make_binary(env, &out.bin), results);
+        } else {
+          enif_release_binary(&out.bin);
+        }
+      }
+    }
+
+    if (subtrees.roots != NULL) {
+      xmlFree(subtrees.roots);
+    }
+    if (owned_roots != NULL) {
+      xmlXPathFreeNodeSet(owned_roots);
+    }
+    if (obj != NULL) {
+      xmlXPathFreeObject(obj);
     }
-  default:
-    break;
   }
 
-  //xmlNs           *ns;        /* pointer to the associated namespace */
-  //xmlChar         *content;   /* the content */
-  //struct _xmlAttr *properties;/* properties list */
-  //xmlNs           *nsDef;     /* namespace definitions on this node */
-  //void            *psvi;      /* for type/PSVI informations */
-  //unsigned short   line;      /* line number */
-  //unsigned short   extra;     /* extra data for XPath/XSLT */
-  SET_POINTER_OR_NULL(ns, node->ns);
-  SET_POINTER_OR_NULL(content, node->content);
-  SET_POINTER_OR_NULL(properties, node->properties);
-  SET_POINTER_OR_NULL(ns_def, node->nsDef);
-  SET_INT(line, node->line);
+  xmlXPathFreeContext(ctx);
+  free_xml_char_pp(inclusive_ns_prefixes, inclusive_ns_prefixes_length);
 
-  PUT(map, ns);
-  PUT(map, content);
-  PUT(map, properties);
-  PUT(map, ns_def);
-  PUT(map, line);
+  if (reason != NULL) {
+    return make_error(env, reason);
+  }
 
-  return make_ok(env, map);
+  enif_make_reverse_list(env, results, &results);
+  return make_ok(env, results);
 }
 
-static ERL_NIF_TERM set_xml_node(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlNodePtr, p, argv[0]);
-  ERL_NIF_TERM map = argv[1];
+// Hashes the string value of every node selected by each XPath in turn.
+// Values are length prefixed and every XPath contributes its node count, so
+// different splits of the same text never produce the same digest.
+static ERL_NIF_TERM xml_xpath_fields_digest(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
+  }
+  if (!enif_is_list(env, argv[1])) {
+    return enif_make_badarg(env);
+  }
 
-  GET(map, private);
-  GET(map, type);
-  GET(map, name);
-  GET(map, children);
-  GET(map, last);
-  GET(map, parent);
-  GET(map, next);
-  GET(map, prev);
-  GET(map, doc);
+  xmlXPathContextPtr ctx = xmlXPathNewContext(doc);
+  if (ctx == NULL) {
+    return make_error(env, "xpath_new_context");
+  }
 
-  GET_POINTER_OR_NULL(void*, private2, private);
-  GET_INT(type2, type);
-  GET_POINTER_OR_NULL(const xmlChar*, name2, name);
-  GET_POINTER_OR_NULL(xmlNodePtr, children2, children);
-  GET_POINTER_OR_NULL(xmlNodePtr, last2, last);
-  GET_POINTER_OR_NULL(xmlNodePtr, parent2, parent);
-  GET_POINTER_OR_NULL(xmlNodePtr, next2, next);
-  GET_POINTER_OR_NULL(xmlNodePtr, prev2, prev);
-  GET_POINTER_OR_NULL(xmlDocPtr, doc2, doc);
+  sha256_ctx sha;
+  sha256_init(&sha);
 
-  p->_private = private2;
-  p->type = type2;
-  p->name = name2;
-  p->children = children2;
-  p->last = last2;
-  p->parent = parent2;
-  p->next = next2;
-  p->prev = prev2;
-  p->doc = doc2;
+  ERL_NIF_TERM head;
+  ERL_NIF_TERM list = argv[1];
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    ErlNifBinary bin;
+    if (!enif_inspect_binary(env, head, &bin)) {
+      xmlXPathFreeContext(ctx);
+      return make_error(env, "failed_to_inspect_binary");
+    }
+    xmlChar* xpath = binary_to_xml_char(&bin);
+    if (xpath == NULL) {
+      xmlXPathFreeContext(ctx);
+      return make_error(env, "malloc_failed");
+    }
+    xmlXPathObjectPtr obj = xmlXPathEval(xpath, ctx);
+    xmlFree(xpath);
+    if (obj == NULL) {
+      xmlXPathFreeContext(ctx);
+      return make_error(env, "xpath_eval");
+    }
 
-  switch (p->type) {
-  // special node types
-  case XML_ATTRIBUTE_NODE:
-  case XML_DTD_NODE:
-  case XML_ELEMENT_DECL:
-  case XML_ATTRIBUTE_DECL:
-  case XML_DOCUMENT_NODE:
-    return enif_make_atom(env, "ok");
-  default:
-    break;
+    if (obj->type == XPATH_NODESET) {
+      int count = obj->nodesetval == NULL ? 0 : obj->nodesetval->nodeNr;
+      unsigned char countbuf[4] = {
+        (unsigned char)(count >> 24), (unsigned char)(count >> 16), (unsigned char)(count >> 8), (unsigned char)count,
+      };
+      sha256_update(&sha, countbuf, 4);
+      for (int i = 0; i < count; i++) {
+        xmlChar* value = xmlXPathCastNodeToString(obj->nodesetval->nodeTab[i]);
+        sha256_update_length_prefixed(&sha, value);
+        xmlFree(value);
+      }
+    } else {
+      unsigned char countbuf[4] = { 0, 0, 0, 1 };
+      sha256_update(&sha, countbuf, 4);
+      xmlChar* value = xmlXPathCastToString(obj);
+      sha256_update_length_prefixed(&sha, value);
+      xmlFree(value);
+    }
+    xmlXPathFreeObject(obj);
   }
 
-  GET(map, ns);
-  GET(map, content);
-  GET(map, properties);
-  GET(map, ns_def);
-  GET(map, line);
+  xmlXPathFreeContext(ctx);
 
-  GET_POINTER_OR_NULL(xmlNsPtr, ns2, ns);
-  GET_POINTER_OR_NULL(xmlChar*, content2, content);
-  GET_POINTER_OR_NULL(xmlAttrPtr, properties2, properties);
-  GET_POINTER_OR_NULL(xmlNsPtr, ns_def2, ns_def);
-  GET_INT(line2, line);
+  return make_ok(env, make_sha256_digest(env, &sha));
+}
 
-  p->ns = ns2;
-  p->content = content2;
-  p->properties = properties2;
-  p->nsDef = ns_def2;
+// A set of digests shared between processes to detect documents seen before.
+// It is a resource, so it lives as long as any process references it and a
+// stale handle can never reach freed memory.
+typedef struct {
+  ErlNifMutex* mutex;
+  xmlHashTablePtr table;
+} digest_set;
 
-  return enif_make_atom(env, "ok");
+static ErlNifResourceType* digest_set_type = NULL;
+
+static void digest_set_dtor(ErlNifEnv* env, void* obj) {
+  digest_set* set = (digest_set*)obj;
+  if (set->table != NULL) {
+    xmlHashFree(set->table, NULL);
+  }
+  if (set->mutex != NULL) {
+    enif_mutex_destroy(set->mutex);
+  }
 }
 
-static ERL_NIF_TERM get_xml_char(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlChar*, str, argv[0]);
+// digests are arbitrary bytes but xmlHashTable keys are C strings
+static xmlChar* digest_to_key(const ErlNifBinary* bin) {
+  static const char hex[] = "0123456789abcdef";
+  xmlChar* key = (xmlChar*)xmlMalloc(bin->size * 2 + 1);
+  if (key == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < bin->size; i++) {
+    key[i * 2] = hex[bin->data[i] >> 4];
+    key[i * 2 + 1] = hex[bin->data[i] & 0x0f];
+  }
+  key[bin->size * 2] = '\0';
+  return key;
+}
 
-  ErlNifBinary bin;
-  int ret = enif_alloc_binary(strlen((const char*)str), &bin);
-  if (ret == 0) {
-    return make_error(env, "bad_alloc");
+static ERL_NIF_TERM xml_digest_set_new(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  digest_set* set = (digest_set*)enif_alloc_resource(digest_set_type, sizeof(digest_set));
+  if (set == NULL) {
+    return make_error(env, "failed_to_alloc_resource");
+  }
+  // the destructor runs on release, so it must see a fully initialized struct
+  set->table = xmlHashCreate(256);
+  set->mutex = enif_mutex_create((char*)"libxml_digest_set");
+  if (set->table == NULL || set->mutex == NULL) {
+    enif_release_resource(set);
+    return make_error(env, "failed_to_new_digest_set");
   }
-  memcpy(bin.data, str, bin.size);
 
-  return make_ok(env, enif_make_binary(env, &bin));
+  ERL_NIF_TERM term = enif_make_resource(env, set);
+  enif_release_resource(set);
+
+  return make_ok(env, term);
 }
 
-static ERL_NIF_TERM get_xml_ns(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlNsPtr, ns, argv[0]);
+// {:ok, 1} if digest was added, {:ok, 0} if it was already in the set
+static ERL_NIF_TERM xml_digest_set_put(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(digest_set, set, argv[0]);
+  GET_BINARY(digest, argv[1]);
 
-  ERL_NIF_TERM map = enif_make_new_map(env);
+  xmlChar* key = digest_to_key(&digest);
+  if (key == NULL) {
+    return make_error(env, "malloc_failed");
+  }
 
-  SET_POINTER_OR_NULL(next, ns->next);
-  SET_POINTER_OR_NULL(href, ns->href);
-  SET_POINTER_OR_NULL(prefix, ns->prefix);
+  int added = 0;
+  int failed = 0;
+  enif_mutex_lock(set->mutex);
+  if (xmlHashLookup(set->table, key) == NULL) {
+    // the payload only has to be non-NULL
+    failed = xmlHashAddEntry(set->table, key, set) != 0;
+    added = !failed;
+  }
+  enif_mutex_unlock(set->mutex);
+  xmlFree(key);
 
-  PUT(map, next);
-  PUT(map, href);
-  PUT(map, prefix);
+  if (failed) {
+    return make_error(env, "failed_to_add_digest");
+  }
 
-  return make_ok(env, map);
+  SET_INT(value, added);
+  return make_ok(env, value);
 }
 
-static ERL_NIF_TERM get_xml_xpath_context(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlXPathContextPtr, p, argv[0]);
+static ERL_NIF_TERM xml_digest_set_member(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(digest_set, set, argv[0]);
+  GET_BINARY(digest, argv[1]);
 
-  ERL_NIF_TERM map = enif_make_new_map(env);
+  xmlChar* key = digest_to_key(&digest);
+  if (key == NULL) {
+    return make_error(env, "malloc_failed");
+  }
 
-  SET_POINTER(doc, p->doc);
-  SET_POINTER_OR_NULL(node, p->node);
+  enif_mutex_lock(set->mutex);
+  int found = xmlHashLookup(set->table, key) != NULL;
+  enif_mutex_unlock(set->mutex);
+  xmlFree(key);
 
-  PUT(map, doc);
-  PUT(map, node);
+  SET_INT(value, found);
+  return make_ok(env, value);
+}
 
-  return make_ok(env, map);
+static ERL_NIF_TERM xml_digest_set_size(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(digest_set, set, argv[0]);
+
+  enif_mutex_lock(set->mutex);
+  int size = xmlHashSize(set->table);
+  enif_mutex_unlock(set->mutex);
+
+  SET_INT(value, size);
+  return make_ok(env, value);
 }
 
-static ERL_NIF_TERM set_xml_xpath_context(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlXPathContextPtr, p, argv[0]);
-  ERL_NIF_TERM map = argv[1];
+static ERL_NIF_TERM xml_xpath_new_context(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
+  }
 
-  GET(map, doc);
-  GET(map, node);
+  xmlXPathContextPtr ctx = xmlXPathNewContext(doc);
+  if (ctx == NULL) {
+    return make_error(env, "xpath_new_context");
+  }
 
-  GET_POINTER(xmlDocPtr, doc2, doc);
-  GET_POINTER_OR_NULL(xmlNodePtr, node2, node);
+  SET_POINTER(ptr, ctx);
 
-  p->doc = doc2;
-  p->node = node2;
+  return make_ok(env, ptr);
+}
+static ERL_NIF_TERM xml_xpath_free_context(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlXPathContextPtr, ctx, argv[0]);
+
+  xmlXPathFreeContext(ctx);
 
   return enif_make_atom(env, "ok");
 }
 
-static ERL_NIF_TERM get_xml_xpath_object(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlXPathObjectPtr, p, argv[0]);
+static ERL_NIF_TERM xml_xpath_eval(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlXPathContextPtr, ctx, argv[0]);
+  GET_BINARY(strbin, argv[1]);
 
-  //xmlXPathObjectType type;
-  //xmlNodeSetPtr nodesetval;
-  //int boolval;
-  //double floatval;
-  //xmlChar *stringval;
-  //void *user;
-  //int index;
-  //void *user2;
-  //int index2;
+  xmlChar* xpath = (xmlChar*)xmlMalloc(strbin.size + 1);
+  if (xpath == NULL) {
+    return make_error(env, "malloc_failed");
+  }
+  memcpy(xpath, strbin.data, strbin.size);
+  xpath[strbin.size] = '\0';
 
-  ERL_NIF_TERM map = enif_make_new_map(env);
+  STATS_START(start);
+  xmlXPathObjectPtr obj = xmlXPathEval(xpath, ctx);
+  stats_record(STATS_XPATH_EVAL, start, strbin.size, obj == NULL);
+  xmlFree(xpath);
+  if (obj == NULL) {
+    return make_error(env, "xpath_eval");
+  }
 
-  SET_INT(type, p->type);
-  PUT(map, type);
+  SET_POINTER(ptr, obj);
 
-  switch (p->type) {
-  case XPATH_UNDEFINED:
-    break;
-  case XPATH_NODESET:
-    {
-      SET_POINTER_OR_NULL(nodesetval, p->nodesetval);
-      PUT(map, nodesetval);
-    }
-    break;
-  case XPATH_XSLT_TREE:
-    {
-      SET_POINTER_OR_NULL(nodesetval, p->nodesetval);
-      PUT(map, nodesetval);
+  return make_ok(env, ptr);
+}
+static ERL_NIF_TERM xml_xpath_free_object(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlXPathObjectPtr, p, argv[0]);
+
+  xmlXPathFreeObject(p);
+
+  return enif_make_atom(env, "ok");
+}
+
+// Snapshot format. table_offset is a little endian uint32, every other
+// integer is an unsigned LEB128 varint:
+//
+//   "LXS1" table_offset doc_header record* END string_table
+//
+//   doc_header:   version_ref encoding_ref url_ref standalone
+//   string_table: count (length bytes)*
+//
+// A *_ref is 0 for none or a 1-based string table index. Names and namespace
+// URIs go through the string table, content is stored inline as length
+// followed by bytes. Records are written in preorder; an element record is
+// followed by its children and an END record:
+//
+//   ELEMENT name prefix_ref href_ref
+//           nsdef_count (prefix_ref href_ref)*
+//           attr_count (name prefix_ref href_ref length bytes)*
+//   TEXT | CDATA | COMMENT  length bytes
+//   PI  name length bytes
+//
+// DTDs are not kept; entity references are stored as their text.
+#define SNAPSHOT_MAGIC "LXS1"
+
+enum {
+  SNAPSHOT_END = 0,
+  SNAPSHOT_ELEMENT,
+  SNAPSHOT_TEXT,
+  SNAPSHOT_CDATA,
+  SNAPSHOT_COMMENT,
+  SNAPSHOT_PI,
+};
+
+typedef struct {
+  binary_output out;
+  xmlHashTablePtr strings;
+  uint32_t count;
+} snapshot_writer;
+
+static void snapshot_write_u32(snapshot_writer* w, uint32_t value) {
+  unsigned char buf[5];
+  int len = 0;
+  do {
+    buf[len] = value & 0x7f;
+    value >>= 7;
+    if (value != 0) {
+      buf[len] |= 0x80;
     }
-    break;
-  case XPATH_BOOLEAN:
-    {
-      SET_INT(boolval, p->boolval);
-      PUT(map, boolval);
+    len++;
+  } while (value != 0);
+  binary_output_write(&w->out, (const char*)buf, len);
+}
+
+static void snapshot_write_u8(snapshot_writer* w, unsigned char value) {
+  binary_output_write(&w->out, (const char*)&value, 1);
+}
+
+static void snapshot_write_bytes(snapshot_writer* w, const xmlChar* data) {
+  int len = data == NULL ? 0 : xmlStrlen(data);
+  snapshot_write_u32(w, len);
+  if (len != 0) {
+    binary_output_write(&w->out, (const char*)data, len);
+  }
+}
+
+// Writes the 1-based string table index of str, adding it on first use.
+static void snapshot_write_ref(snapshot_writer* w, const xmlChar* str) {
+  if (str == NULL) {
+    snapshot_write_u32(w, 0);
+    return;
+  }
+  uint32_t index = (uint32_t)(uintptr_t)xmlHashLookup(w->strings, str);
+  if (index == 0) {
+    index = w->count + 1;
+    if (xmlHashAddEntry(w->strings, str, (void*)(uintptr_t)index) != 0) {
+      w->out.failed = 1;
+      return;
     }
-    break;
-  case XPATH_NUMBER:
+    w->count++;
+  }
+  snapshot_write_u32(w, index);
+}
+
+static void snapshot_write_ns(snapshot_writer* w, xmlNsPtr ns) {
+  snapshot_write_ref(w, ns == NULL ? NULL : ns->prefix);
+  snapshot_write_ref(w, ns == NULL ? NULL : ns->href);
+}
+
+static void snapshot_collect_string(void* payload, void* data, xmlChar* name) {
+  const xmlChar** table = (const xmlChar**)data;
+  table[(uintptr_t)payload - 1] = name;
+}
+
+// Writes the record for node, without the END of an element. Returns 0 if the
+// node kind is not kept.
+static int snapshot_write_node(snapshot_writer* w, xmlNodePtr node) {
+  switch (node->type) {
+  case XML_ELEMENT_NODE:
     {
-      SET_DOUBLE(floatval, p->floatval);
-      PUT(map, floatval);
+      snapshot_write_u8(w, SNAPSHOT_ELEMENT);
+      snapshot_write_ref(w, node->name);
+      snapshot_write_ns(w, node->ns);
+
+      uint32_t count = 0;
+      for (xmlNsPtr ns = node->nsDef; ns != NULL; ns = ns->next) {
+        count++;
+      }
+      snapshot_write_u32(w, count);
+      for (xmlNsPtr ns = node->nsDef; ns != NULL; ns = ns->next) {
+        snapshot_write_ns(w, ns);
+      }
+
+      count = 0;
+      for (xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) {
+        count++;
+      }
+      snapshot_write_u32(w, count);
+      for (xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) {
+        snapshot_write_ref(w, attr->name);
+        snapshot_write_ns(w, attr->ns);
+        xmlNodePtr text = attr->children;
+        if (text != NULL && text->type == XML_TEXT_NODE && text->next == NULL) {
+          snapshot_write_bytes(w, text->content);
+        } else {
+          xmlChar* value = xmlNodeGetContent((xmlNodePtr)attr);
+          snapshot_write_bytes(w, value);
+          xmlFree(value);
+        }
+      }
     }
-    break;
-  case XPATH_STRING:
+    return 1;
+  case XML_TEXT_NODE:
+    snapshot_write_u8(w, SNAPSHOT_TEXT);
+    snapshot_write_bytes(w, node->content);
+    return 1;
+  case XML_CDATA_SECTION_NODE:
+    snapshot_write_u8(w, SNAPSHOT_CDATA);
+    snapshot_write_bytes(w, node->content);
+    return 1;
+  case XML_COMMENT_NODE:
+    snapshot_write_u8(w, SNAPSHOT_COMMENT);
+    snapshot_write_bytes(w, node->content);
+    return 1;
+  case XML_PI_NODE:
+    snapshot_write_u8(w, SNAPSHOT_PI);
+    snapshot_write_ref(w, node->name);
+    snapshot_write_bytes(w, node->content);
+    return 1;
+  case XML_ENTITY_REF_NODE:
     {
-      SET_POINTER_OR_NULL(stringval, p->stringval);
-      PUT(map, stringval);
+      xmlChar* value = xmlNodeGetContent(node);
+      snapshot_write_u8(w, SNAPSHOT_TEXT);
+      snapshot_write_bytes(w, value);
+      xmlFree(value);
     }
-    break;
-  case XPATH_POINT:
-    {
-      SET_INT(index, p->index);
-      SET_POINTER_OR_NULL(user, p->user);
-      PUT(map, index);
-      PUT(map, user);
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static ERL_NIF_TERM xml_doc_to_snapshot(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
+  }
+
+  snapshot_writer w;
+  w.count = 0;
+  w.out.size = 0;
+  w.out.failed = !enif_alloc_binary(4096, &w.out.bin);
+  if (w.out.failed) {
+    return make_error(env, "failed_to_alloc_binary");
+  }
+  w.strings = xmlHashCreate(256);
+  if (w.strings == NULL) {
+    enif_release_binary(&w.out.bin);
+    return make_error(env, "failed_to_create_hash");
+  }
+
+  // magic and table_offset, patched below
+  binary_output_write(&w.out, SNAPSHOT_MAGIC "\0\0\0\0", 8);
+  snapshot_write_ref(&w, doc->version);
+  snapshot_write_ref(&w, doc->encoding);
+  snapshot_write_ref(&w, doc->URL);
+  snapshot_write_u32(&w, (uint32_t)doc->standalone);
+
+  // iterative preorder walk, so deep documents cannot overflow the C stack
+  xmlNodePtr cur = doc->children;
+  while (cur != NULL && !w.out.failed) {
+    if (snapshot_write_node(&w, cur) && cur->type == XML_ELEMENT_NODE) {
+      if (cur->children != NULL) {
+        cur = cur->children;
+        continue;
+      }
+      snapshot_write_u8(&w, SNAPSHOT_END);
     }
-    break;
-  case XPATH_RANGE:
-    {
-      SET_INT(index, p->index);
-      SET_INT(index2, p->index2);
-      SET_POINTER_OR_NULL(user, p->user);
-      SET_POINTER_OR_NULL(user2, p->user2);
-      PUT(map, index);
-      PUT(map, index2);
-      PUT(map, user);
-      PUT(map, user2);
+    while (cur != NULL && cur->next == NULL) {
+      cur = cur->parent;
+      if (cur == (xmlNodePtr)doc) {
+        cur = NULL;
+      } else if (cur != NULL) {
+        snapshot_write_u8(&w, SNAPSHOT_END);
+      }
     }
-    break;
-  case XPATH_LOCATIONSET:
-    {
-      SET_POINTER_OR_NULL(user, p->user);
-      PUT(map, user);
+    if (cur != NULL) {
+      cur = cur->next;
     }
-    break;
-  case XPATH_USERS:
-    break;
   }
-  return make_ok(env, map);
+  snapshot_write_u8(&w, SNAPSHOT_END);
+
+  uint32_t table_offset = (uint32_t)w.out.size;
+  const xmlChar** table = (const xmlChar**)xmlMalloc(sizeof(xmlChar*) * (w.count + 1));
+  if (table == NULL) {
+    w.out.failed = 1;
+  } else {
+    xmlHashScan(w.strings, snapshot_collect_string, table);
+    snapshot_write_u32(&w, w.count);
+    for (uint32_t i = 0; i < w.count; i++) {
+      snapshot_write_bytes(&w, table[i]);
+    }
+    xmlFree((void*)table);
+  }
+  xmlHashFree(w.strings, NULL);
+
+  // a failed write leaves the original allocation in place, release it too
+  if (w.out.failed || w.out.size > UINT32_MAX || !enif_realloc_binary(&w.out.bin, w.out.size)) {
+    enif_release_binary(&w.out.bin);
+    return make_error(env, "failed_to_write_snapshot");
+  }
+  for (int i = 0; i < 4; i++) {
+    w.out.bin.data[4 + i] = (table_offset >> (8 * i)) & 0xff;
+  }
+
+  return make_ok(env, enif_make_binary(env, &w.out.bin));
+}
+
+// Every read is bounds checked; once anything is out of range failed is set
+// and reads return 0.
+typedef struct {
+  const unsigned char* data;
+  size_t size;
+  size_t pos;
+  int failed;
+  const xmlChar** strings;
+  uint32_t count;
+} snapshot_reader;
+
+static uint32_t snapshot_read_u32(snapshot_reader* r) {
+  uint32_t value = 0;
+  for (int shift = 0; !r->failed && shift < 35; shift += 7) {
+    if (r->pos >= r->size) {
+      break;
+    }
+    unsigned char byte = r->data[r->pos++];
+    if (shift == 28 && byte > 0x0f) {
+      break;
+    }
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  r->failed = 1;
+  return 0;
+}
+
+static int snapshot_read_u8(snapshot_reader* r) {
+  if (r->failed || r->pos >= r->size) {
+    r->failed = 1;
+    return -1;
+  }
+  return r->data[r->pos++];
+}
+
+// Returns the inline bytes and their length, pointing into the snapshot.
+static const unsigned char* snapshot_read_bytes(snapshot_reader* r, uint32_t* len) {
+  *len = snapshot_read_u32(r);
+  if (r->failed || r->size - r->pos < *len) {
+    r->failed = 1;
+    *len = 0;
+    return NULL;
+  }
+  const unsigned char* p = r->data + r->pos;
+  r->pos += *len;
+  return p;
+}
+
+// NULL for ref 0 and for an out of range ref, which also sets failed.
+static const xmlChar* snapshot_read_ref(snapshot_reader* r) {
+  uint32_t ref = snapshot_read_u32(r);
+  if (ref == 0) {
+    return NULL;
+  }
+  if (ref > r->count) {
+    r->failed = 1;
+    return NULL;
+  }
+  return r->strings[ref - 1];
+}
+
+static xmlChar* snapshot_read_string(snapshot_reader* r) {
+  uint32_t len;
+  const unsigned char* p = snapshot_read_bytes(r, &len);
+  return r->failed ? NULL : xmlStrndup(p, len);
+}
+
+// The in-scope namespace for prefix and href, declared on node if needed.
+static xmlNsPtr snapshot_resolve_ns(xmlDocPtr doc, xmlNodePtr node, const xmlChar* prefix, const xmlChar* href) {
+  xmlNsPtr ns = xmlSearchNs(doc, node, prefix);
+  if (ns != NULL && xmlStrEqual(ns->href, href)) {
+    return ns;
+  }
+  return xmlNewNs(node, href, prefix);
+}
+
+// Like the SAX2 parser, text shorter than two pointers is stored inside the
+// node itself, which xmlFreeNode and the content setters know about.
+static xmlNodePtr snapshot_new_text(xmlDocPtr doc, const unsigned char* data, uint32_t len) {
+  if (len >= 2 * sizeof(void*)) {
+    return xmlNewDocTextLen(doc, data, len);
+  }
+  xmlNodePtr node = xmlNewDocTextLen(doc, NULL, 0);
+  if (node != NULL) {
+    node->content = (xmlChar*)&node->properties;
+    memcpy(node->content, data, len);
+    node->content[len] = '\0';
+  }
+  return node;
+}
+
+static void snapshot_link(xmlNodePtr parent, xmlNodePtr node) {
+  node->parent = parent;
+  node->prev = parent->last;
+  if (parent->last != NULL) {
+    parent->last->next = node;
+  } else {
+    parent->children = node;
+  }
+  parent->last = node;
+}
+
+static xmlNodePtr snapshot_read_element(snapshot_reader* r, xmlDocPtr doc, xmlNodePtr parent) {
+  const xmlChar* name = snapshot_read_ref(r);
+  const xmlChar* prefix = snapshot_read_ref(r);
+  const xmlChar* href = snapshot_read_ref(r);
+  if (r->failed || name == NULL) {
+    return NULL;
+  }
+
+  // names are owned by the document dictionary
+  xmlNodePtr node = xmlNewDocNodeEatName(doc, NULL, (xmlChar*)name, NULL);
+  if (node == NULL) {
+    return NULL;
+  }
+  snapshot_link(parent, node);
+
+  uint32_t count = snapshot_read_u32(r);
+  for (uint32_t i = 0; i < count && !r->failed; i++) {
+    const xmlChar* def_prefix = snapshot_read_ref(r);
+    const xmlChar* def_href = snapshot_read_ref(r);
+    if (r->failed || def_href == NULL || xmlNewNs(node, def_href, def_prefix) == NULL) {
+      r->failed = 1;
+    }
+  }
+  if (!r->failed && href != NULL) {
+    node->ns = snapshot_resolve_ns(doc, node, prefix, href);
+    r->failed = node->ns == NULL;
+  }
+
+  count = snapshot_read_u32(r);
+  for (uint32_t i = 0; i < count && !r->failed; i++) {
+    const xmlChar* attr_name = snapshot_read_ref(r);
+    const xmlChar* attr_prefix = snapshot_read_ref(r);
+    const xmlChar* attr_href = snapshot_read_ref(r);
+    uint32_t len;
+    const unsigned char* value = snapshot_read_bytes(r, &len);
+    if (r->failed || attr_name == NULL) {
+      r->failed = 1;
+      break;
+    }
+
+    xmlNsPtr ns = attr_href == NULL ? NULL : snapshot_resolve_ns(doc, node, attr_prefix, attr_href);
+    xmlAttrPtr attr = attr_href != NULL && ns == NULL ? NULL : xmlNewNsPropEatName(node, ns, (xmlChar*)attr_name, NULL);
+    xmlNodePtr text = attr == NULL ? NULL : snapshot_new_text(doc, value, len);
+    if (text == NULL) {
+      r->failed = 1;
+      break;
+    }
+    snapshot_link((xmlNodePtr)attr, text);
+    // xmlNewNsProp does this when given the value up front
+    if (xmlIsID(doc, node, attr) == 1) {
+      xmlAddID(NULL, doc, text->content, attr);
+    }
+  }
+
+  return node;
+}
+
+// Rebuilds a document without tokenizing: every name is interned into the
+// document dictionary once and nodes are linked directly.
+static ERL_NIF_TERM xml_doc_from_snapshot(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(snapshot, argv[0]);
+
+  snapshot_reader r = { snapshot.data, snapshot.size, 0, 0, NULL, 0 };
+  if (snapshot.size < 8 || memcmp(snapshot.data, SNAPSHOT_MAGIC, 4) != 0) {
+    return make_error(env, "invalid_snapshot");
+  }
+  const unsigned char* header = snapshot.data + 4;
+  uint32_t table_offset = (uint32_t)header[0] | ((uint32_t)header[1] << 8) | ((uint32_t)header[2] << 16) |
+                          ((uint32_t)header[3] << 24);
+  size_t records = 8;
+  if (table_offset < records || table_offset > snapshot.size) {
+    return make_error(env, "invalid_snapshot");
+  }
+
+  xmlDocPtr doc = xmlNewDoc(NULL);
+  if (doc == NULL) {
+    return make_error(env, "failed_to_new_doc");
+  }
+  xmlFree((xmlChar*)doc->version);
+  doc->version = NULL;
+  doc->dict = xmlDictCreate();
+  if (doc->dict == NULL) {
+    xmlFreeDoc(doc);
+    return make_error(env, "failed_to_create_dict");
+  }
+
+  r.pos = table_offset;
+  r.count = snapshot_read_u32(&r);
+  // every entry takes at least one byte, which bounds the allocation
+  if (r.failed || r.count > r.size - r.pos) {
+    xmlFreeDoc(doc);
+    return make_error(env, "invalid_snapshot");
+  }
+  r.strings = (const xmlChar**)xmlMalloc(sizeof(xmlChar*) * (r.count + 1));
+  if (r.strings == NULL) {
+    xmlFreeDoc(doc);
+    return make_error(env, "malloc_failed");
+  }
+  for (uint32_t i = 0; i < r.count && !r.failed; i++) {
+    uint32_t len;
+    const unsigned char* p = snapshot_read_bytes(&r, &len);
+    r.strings[i] = r.failed ? NULL : xmlDictLookup(doc->dict, p, len);
+    r.failed = r.failed || r.strings[i] == NULL;
+  }
+
+  // records must not run into the string table
+  r.size = table_offset;
+  r.pos = records;
+
+  const xmlChar* version = snapshot_read_ref(&r);
+  const xmlChar* encoding = snapshot_read_ref(&r);
+  const xmlChar* url = snapshot_read_ref(&r);
+  doc->standalone = (int)snapshot_read_u32(&r);
+  doc->version = xmlStrdup(version != NULL ? version : (const xmlChar*)"1.0");
+  doc->encoding = encoding != NULL ? xmlStrdup(encoding) : NULL;
+  doc->URL = url != NULL ? xmlStrdup(url) : NULL;
+
+  xmlNodePtr parent = (xmlNodePtr)doc;
+  int done = 0;
+  while (!r.failed && !done) {
+    int tag = snapshot_read_u8(&r);
+    xmlNodePtr node = NULL;
+    uint32_t len;
+    const unsigned char* p;
+    xmlChar* str;
+    switch (tag) {
+    case SNAPSHOT_END:
+      if (parent == (xmlNodePtr)doc) {
+        done = 1;
+      } else {
+        parent = parent->parent;
+      }
+      continue;
+    case SNAPSHOT_ELEMENT:
+      node = snapshot_read_element(&r, doc, parent);
+      if (node != NULL) {
+        parent = node;
+      }
+      break;
+    case SNAPSHOT_TEXT:
+    case SNAPSHOT_CDATA:
+      p = snapshot_read_bytes(&r, &len);
+      if (!r.failed && parent != (xmlNodePtr)doc) {
+        node = tag == SNAPSHOT_TEXT ? snapshot_new_text(doc, p, len) : xmlNewCDataBlock(doc, p, len);
+        if (node != NULL) {
+          snapshot_link(parent, node);
+        }
+      }
+      break;
+    case SNAPSHOT_COMMENT:
+      str = snapshot_read_string(&r);
+      node = str == NULL ? NULL : xmlNewDocComment(doc, str);
+      xmlFree(str);
+      if (node != NULL) {
+        snapshot_link(parent, node);
+      }
+      break;
+    case SNAPSHOT_PI:
+      {
+        const xmlChar* name = snapshot_read_ref(&r);
+        str = snapshot_read_string(&r);
+        node = name == NULL || str == NULL ? NULL : xmlNewDocPI(doc, name, str);
+        xmlFree(str);
+        if (node != NULL) {
+          snapshot_link(parent, node);
+        }
+      }
+      break;
+    default:
+      break;
+    }
+    if (node == NULL) {
+      r.failed = 1;
+    }
+  }
+  xmlFree((void*)r.strings);
+
+  if (r.failed || r.pos != r.size) {
+    xmlFreeDoc(doc);
+    return make_error(env, "invalid_snapshot");
+  }
+
+  SET_POINTER(ptr, doc);
+
+  return make_ok(env, ptr);
+}
+
+// Streaming extraction: an xmlTextReader walks the input while every
+// compiled pattern follows along through its own xmlStreamCtxt. Matched
+// elements are read as a whole, so no document is ever built and memory stays
+// bounded by the largest match, not the input.
+typedef struct {
+  ErlNifMutex* mutex;
+  // keeps the input binary of a memory stream alive
+  ErlNifEnv* env;
+  // the open file of a file stream, the reader does not close it
+  int fd;
+  xmlTextReaderPtr reader;
+  int count;
+  xmlPatternPtr* patterns;
+  xmlStreamCtxtPtr* streams;
+  int* matches;
+  int has_attrs;
+  int outer_xml;
+  int done;
+} pattern_stream;
+
+static ErlNifResourceType* pattern_stream_type = NULL;
+
+static void pattern_stream_close(pattern_stream* ps) {
+  if (ps->reader != NULL) {
+    xmlFreeTextReader(ps->reader);
+    ps->reader = NULL;
+  }
+  if (ps->fd >= 0) {
+    close(ps->fd);
+    ps->fd = -1;
+  }
+  for (int i = 0; i < ps->count; i++) {
+    if (ps->streams != NULL && ps->streams[i] != NULL) {
+      xmlFreeStreamCtxt(ps->streams[i]);
+    }
+    if (ps->patterns != NULL && ps->patterns[i] != NULL) {
+      xmlFreePattern(ps->patterns[i]);
+    }
+  }
+  xmlFree(ps->streams);
+  xmlFree(ps->patterns);
+  xmlFree(ps->matches);
+  ps->streams = NULL;
+  ps->patterns = NULL;
+  ps->matches = NULL;
+  ps->count = 0;
+  if (ps->env != NULL) {
+    enif_free_env(ps->env);
+    ps->env = NULL;
+  }
+  ps->done = 1;
+}
+
+static void pattern_stream_dtor(ErlNifEnv* env, void* obj) {
+  pattern_stream* ps = (pattern_stream*)obj;
+  pattern_stream_close(ps);
+  if (ps->mutex != NULL) {
+    enif_mutex_destroy(ps->mutex);
+  }
+}
+
+// Compiles argv[1] (patterns) with argv[2] (flat [uri, prefix, ...] list)
+// and argv[3] (output mode) into a new stream without a reader. Returns NULL
+// and sets *out on success, or the error reason.
+static const char* pattern_stream_new(ErlNifEnv* env, const ERL_NIF_TERM argv[], pattern_stream** out) {
+  *out = NULL;
+
+  int outer_xml;
+  if (!enif_get_int(env, argv[3], &outer_xml)) {
+    return "failed_to_get_int";
+  }
+
+  unsigned int count;
+  if (!enif_get_list_length(env, argv[1], &count)) {
+    return "failed_to_get_list_length";
+  }
+
+  xmlChar** namespaces;
+  unsigned int namespaces_length;
+  const char* reason = get_xml_char_pp(env, argv[2], &namespaces, &namespaces_length);
+  if (reason != NULL) {
+    return reason;
+  }
+
+  pattern_stream* ps = (pattern_stream*)enif_alloc_resource(pattern_stream_type, sizeof(pattern_stream));
+  if (ps == NULL) {
+    free_xml_char_pp(namespaces, namespaces_length);
+    return "failed_to_alloc_resource";
+  }
+  memset(ps, 0, sizeof(pattern_stream));
+  ps->fd = -1;
+  ps->outer_xml = outer_xml;
+  ps->mutex = enif_mutex_create((char*)"libxml_pattern_stream");
+  ps->patterns = (xmlPatternPtr*)xmlMalloc(sizeof(xmlPatternPtr) * (count + 1));
+  ps->streams = (xmlStreamCtxtPtr*)xmlMalloc(sizeof(xmlStreamCtxtPtr) * (count + 1));
+  ps->matches = (int*)xmlMalloc(sizeof(int) * (count + 1));
+  if (ps->mutex == NULL || ps->patterns == NULL || ps->streams == NULL || ps->matches == NULL) {
+    reason = "malloc_failed";
+  } else {
+    memset(ps->patterns, 0, sizeof(xmlPatternPtr) * (count + 1));
+    memset(ps->streams, 0, sizeof(xmlStreamCtxtPtr) * (count + 1));
+    ps->count = count;
+  }
+
+  ERL_NIF_TERM list = argv[1];
+  for (int i = 0; reason == NULL && i < count; i++) {
+    ERL_NIF_TERM head;
+    enif_get_list_cell(env, list, &head, &list);
+
+    ErlNifBinary bin;
+    if (!enif_inspect_binary(env, head, &bin)) {
+      reason = "failed_to_inspect_binary";
+      break;
+    }
+    xmlChar* str = binary_to_xml_char(&bin);
+    if (str == NULL) {
+      reason = "malloc_failed";
+      break;
+    }
+    ps->patterns[i] = xmlPatterncompile(str, NULL, 0, (const xmlChar**)namespaces);
+    xmlFree(str);
+
+    if (ps->patterns[i] == NULL) {
+      reason = "failed_to_compile_pattern";
+    } else if (xmlPatternStreamable(ps->patterns[i]) != 1) {
+      reason = "pattern_not_streamable";
+    } else if ((ps->streams[i] = xmlPatternGetStreamCtxt(ps->patterns[i])) == NULL) {
+      reason = "failed_to_get_stream_ctxt";
+    } else if (xmlStreamPush(ps->streams[i], NULL, NULL) < 0) {
+      // the document node, needed for absolute patterns to match
+      reason = "failed_to_push_stream";
+    } else if (memchr(bin.data, '@', bin.size) != NULL) {
+      ps->has_attrs = 1;
+    }
+  }
+  free_xml_char_pp(namespaces, namespaces_length);
+
+  if (reason != NULL) {
+    enif_release_resource(ps);
+    return reason;
+  }
+
+  *out = ps;
+  return NULL;
+}
+
+static ERL_NIF_TERM pattern_stream_result(ErlNifEnv* env, pattern_stream* ps) {
+  if (ps->reader == NULL) {
+    enif_release_resource(ps);
+    return make_error(env, "failed_to_new_reader");
+  }
+
+  ERL_NIF_TERM term = enif_make_resource(env, ps);
+  enif_release_resource(ps);
+
+  return make_ok(env, term);
+}
+
+static ERL_NIF_TERM xml_pattern_stream_memory(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  pattern_stream* ps;
+  const char* reason = pattern_stream_new(env, argv, &ps);
+  if (reason != NULL) {
+    return make_error(env, reason);
+  }
+
+  ps->env = enif_alloc_env();
+  ErlNifBinary content;
+  if (ps->env == NULL || !enif_inspect_binary(ps->env, enif_make_copy(ps->env, argv[0]), &content)) {
+    enif_release_resource(ps);
+    return make_error(env, "failed_to_inspect_binary");
+  }
+  ps->reader = xmlReaderForMemory((const char*)content.data, content.size, "noname.xml", NULL, 0);
+
+  return pattern_stream_result(env, ps);
+}
+
+static ERL_NIF_TERM xml_pattern_stream_file(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(path, argv[0]);
+
+  pattern_stream* ps;
+  const char* reason = pattern_stream_new(env, argv, &ps);
+  if (reason != NULL) {
+    return make_error(env, reason);
+  }
+
+  xmlChar* pathstr = binary_to_xml_char(&path);
+  if (pathstr == NULL) {
+    enif_release_resource(ps);
+    return make_error(env, "malloc_failed");
+  }
+  // same as xml_read_file, xmlReaderForFile would also fetch remote URLs
+  ps->fd = open((const char*)pathstr, O_RDONLY);
+  if (ps->fd >= 0) {
+    ps->reader = xmlReaderForFd(ps->fd, (const char*)pathstr, NULL, 0);
+  }
+  xmlFree(pathstr);
+
+  return pattern_stream_result(env, ps);
+}
+
+static int pattern_stream_pop_all(pattern_stream* ps) {
+  for (int i = 0; i < ps->count; i++) {
+    if (xmlStreamPop(ps->streams[i]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static ERL_NIF_TERM pattern_match_term(ErlNifEnv* env, int index, const xmlChar* value) {
+  SET_STRING(term, (const char*)value);
+  return enif_make_tuple2(env, enif_make_int(env, index), term);
+}
+
+// Reads until at least max matches are collected or the input ends. Each
+// match is {pattern_index, value}; an empty list means the stream is done.
+static ERL_NIF_TERM xml_pattern_stream_next(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(pattern_stream, ps, argv[0]);
+  GET_INT(max, argv[1]);
+  // an empty batch would be taken for the end of the stream
+  if (max < 1) {
+    return enif_make_badarg(env);
+  }
+
+  ERL_NIF_TERM results = enif_make_list(env, 0);
+  const char* reason = NULL;
+  int found = 0;
+
+  enif_mutex_lock(ps->mutex);
+  xmlTextReaderPtr reader = ps->reader;
+  while (!ps->done && found < max) {
+    int ret = xmlTextReaderRead(reader);
+    if (ret <= 0) {
+      reason = ret < 0 ? "failed_to_read" : NULL;
+      ps->done = 1;
+      break;
+    }
+
+    int type = xmlTextReaderNodeType(reader);
+    if (type == XML_READER_TYPE_END_ELEMENT) {
+      if (pattern_stream_pop_all(ps) < 0) {
+        reason = "failed_to_pop_stream";
+        ps->done = 1;
+      }
+      continue;
+    }
+    if (type != XML_READER_TYPE_ELEMENT) {
+      continue;
+    }
+
+    const xmlChar* name = xmlTextReaderConstLocalName(reader);
+    const xmlChar* ns = xmlTextReaderConstNamespaceUri(reader);
+    int empty = xmlTextReaderIsEmptyElement(reader);
+    int matched = 0;
+    for (int i = 0; i < ps->count; i++) {
+      ps->matches[i] = xmlStreamPush(ps->streams[i], name, ns);
+      if (ps->matches[i] < 0) {
+        reason = "failed_to_push_stream";
+      }
+      matched |= ps->matches[i] == 1;
+    }
+    if (reason != NULL) {
+      ps->done = 1;
+      break;
+    }
+
+    // reading the value leaves the reader on the element, so its
+    // descendants are still walked and can match on their own
+    if (matched) {
+      xmlChar* value = ps->outer_xml ? xmlTextReaderReadOuterXml(reader) : xmlTextReaderReadString(reader);
+      for (int i = 0; i < ps->count; i++) {
+        if (ps->matches[i] == 1) {
+          results = enif_make_list_cell(env, pattern_match_term(env, i, value), results);
+          found++;
+        }
+      }
+      xmlFree(value);
+    }
+
+    if (ps->has_attrs) {
+      while (xmlTextReaderMoveToNextAttribute(reader) == 1) {
+        if (xmlTextReaderIsNamespaceDecl(reader) == 1) {
+          continue;
+        }
+        const xmlChar* attr_name = xmlTextReaderConstLocalName(reader);
+        const xmlChar* attr_ns = xmlTextReaderConstNamespaceUri(reader);
+        for (int i = 0; i < ps->count; i++) {
+          if (xmlStreamPushAttr(ps->streams[i], attr_name, attr_ns) == 1) {
+            results = enif_make_list_cell(env, pattern_match_term(env, i, xmlTextReaderConstValue(reader)), results);
+            found++;
+          }
+          xmlStreamPop(ps->streams[i]);
+        }
+      }
+      xmlTextReaderMoveToElement(reader);
+    }
+
+    if (empty && pattern_stream_pop_all(ps) < 0) {
+      reason = "failed_to_pop_stream";
+      ps->done = 1;
+    }
+  }
+  if (ps->done) {
+    pattern_stream_close(ps);
+  }
+  enif_mutex_unlock(ps->mutex);
+
+  if (reason != NULL) {
+    return make_error(env, reason);
+  }
+
+  enif_make_reverse_list(env, results, &results);
+  return make_ok(env, results);
+}
+
+// Frees the reader and input before the resource itself is collected.
+static ERL_NIF_TERM xml_pattern_stream_close(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(pattern_stream, ps, argv[0]);
+
+  enif_mutex_lock(ps->mutex);
+  pattern_stream_close(ps);
+  enif_mutex_unlock(ps->mutex);
+
+  return enif_make_atom(env, "ok");
+}
+
+// Parse state for xml_read_memory_until, reached through ctxt->_private.
+typedef struct {
+  startElementNsSAX2Func start_element;
+  endElementNsSAX2Func end_element;
+  int max_depth;
+  int max_elements;
+  xmlStreamCtxtPtr target;
+  int depth;
+  int elements;
+  // depth of the matched target element, stop once it is closed
+  int target_depth;
+  const char* reason;
+  long consumed;
+} parse_until;
+
+static void parse_until_stop(xmlParserCtxtPtr ctxt, parse_until* state, const char* reason) {
+  state->reason = reason;
+  state->consumed = xmlByteConsumed(ctxt);
+  xmlStopParser(ctxt);
+}
+
+static void parse_until_start_element(void* ctx, const xmlChar* localname, const xmlChar* prefix,
+                                      const xmlChar* URI, int nb_namespaces, const xmlChar** namespaces,
+                                      int nb_attributes, int nb_defaulted, const xmlChar** attributes) {
+  xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+  parse_until* state = (parse_until*)ctxt->_private;
+
+  // limits stop before the offending element is added
+  if (state->max_depth > 0 && state->depth + 1 > state->max_depth) {
+    parse_until_stop(ctxt, state, "max_depth");
+    return;
+  }
+  if (state->max_elements > 0 && state->elements + 1 > state->max_elements) {
+    parse_until_stop(ctxt, state, "max_elements");
+    return;
+  }
+
+  state->depth++;
+  state->elements++;
+  state->start_element(ctx, localname, prefix, URI, nb_namespaces, namespaces, nb_attributes, nb_defaulted, attributes);
+
+  if (state->target != NULL && state->target_depth == 0 && xmlStreamPush(state->target, localname, URI) == 1) {
+    state->target_depth = state->depth;
+  }
+}
+
+static void parse_until_end_element(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI) {
+  xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+  parse_until* state = (parse_until*)ctxt->_private;
+
+  state->end_element(ctx, localname, prefix, URI);
+
+  // the target is returned complete, with its subtree
+  if (state->target_depth != 0 && state->target_depth == state->depth) {
+    state->depth--;
+    parse_until_stop(ctxt, state, "target");
+    return;
+  }
+  if (state->target != NULL && state->target_depth == 0) {
+    xmlStreamPop(state->target);
+  }
+  state->depth--;
+}
+
+// Parses like xml_read_memory but stops as soon as a limit is reached: more
+// than max_depth levels, more than max_elements elements, or the end of the
+// first element matching the streamable target pattern. 0 and "" disable a
+// limit. Returns the document parsed so far and why parsing ended: max_depth,
+// max_elements, target or eof.
+static ERL_NIF_TERM xml_read_memory_until(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(content, argv[0]);
+  GET_INT(max_depth, argv[1]);
+  GET_INT(max_elements, argv[2]);
+  GET_BINARY(target, argv[3]);
+
+  parse_until state;
+  memset(&state, 0, sizeof(state));
+  state.max_depth = max_depth;
+  state.max_elements = max_elements;
+
+  xmlPatternPtr pattern = NULL;
+  if (target.size != 0) {
+    xmlChar** namespaces;
+    unsigned int namespaces_length;
+    const char* reason = get_xml_char_pp(env, argv[4], &namespaces, &namespaces_length);
+    if (reason != NULL) {
+      return make_error(env, reason);
+    }
+    xmlChar* targetstr = binary_to_xml_char(&target);
+    pattern = targetstr == NULL ? NULL : xmlPatterncompile(targetstr, NULL, 0, (const xmlChar**)namespaces);
+    xmlFree(targetstr);
+    free_xml_char_pp(namespaces, namespaces_length);
+
+    if (pattern == NULL) {
+      return make_error(env, "failed_to_compile_pattern");
+    }
+    if (xmlPatternStreamable(pattern) != 1 || (state.target = xmlPatternGetStreamCtxt(pattern)) == NULL) {
+      xmlFreePattern(pattern);
+      return make_error(env, "pattern_not_streamable");
+    }
+    // the document node
+    xmlStreamPush(state.target, NULL, NULL);
+  }
+
+  xmlParserCtxtPtr ctxt = xmlCreateMemoryParserCtxt((const char*)content.data, content.size);
+  if (ctxt == NULL) {
+    if (pattern != NULL) {
+      xmlFreeStreamCtxt(state.target);
+      xmlFreePattern(pattern);
+    }
+    return make_error(env, "failed_to_create_parser_ctxt");
+  }
+  xmlCtxtUseOptions(ctxt, 0);
+  if (ctxt->input != NULL && ctxt->input->filename == NULL) {
+    ctxt->input->filename = (char*)xmlStrdup((const xmlChar*)"noname.xml");
+  }
+
+  // the SAX handler belongs to this context only
+  state.start_element = ctxt->sax->startElementNs;
+  state.end_element = ctxt->sax->endElementNs;
+  ctxt->sax->startElementNs = parse_until_start_element;
+  ctxt->sax->endElementNs = parse_until_end_element;
+  ctxt->_private = &state;
+
+  STATS_START(start);
+  xmlParseDocument(ctxt);
+
+  xmlDocPtr doc = ctxt->myDoc;
+  ctxt->myDoc = NULL;
+  int stopped = state.reason != NULL && ctxt->errNo == XML_ERR_USER_STOP;
+  if (!stopped && !ctxt->wellFormed && doc != NULL) {
+    xmlFreeDoc(doc);
+    doc = NULL;
+  }
+  stats_record(STATS_READ_MEMORY, start, stopped ? state.consumed : content.size, doc == NULL);
+  xmlFreeParserCtxt(ctxt);
+  if (pattern != NULL) {
+    xmlFreeStreamCtxt(state.target);
+    xmlFreePattern(pattern);
+  }
+
+  if (doc == NULL) {
+    return make_error(env, "failed_to_parse_document");
+  }
+
+  SET_POINTER(ptr, doc);
+  ERL_NIF_TERM reason = enif_make_atom(env, stopped ? state.reason : "eof");
+
+  return make_ok(env, enif_make_tuple2(env, ptr, reason));
+}
+
+// A frozen document is a private deep copy owned by a resource. Nothing
+// writes to it after xml_freeze_doc, so any number of processes can query it
+// at the same time without locking, and it is freed once the last reference
+// is garbage collected.
+typedef struct {
+  xmlDocPtr doc;
+} frozen_doc;
+
+static ErlNifResourceType* frozen_doc_type = NULL;
+
+static void frozen_doc_dtor(ErlNifEnv* env, void* obj) {
+  frozen_doc* frozen = (frozen_doc*)obj;
+  if (frozen->doc != NULL) {
+    xmlFreeDoc(frozen->doc);
+  }
+}
+
+static ERL_NIF_TERM xml_freeze_doc(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
+  }
+
+  frozen_doc* frozen = (frozen_doc*)enif_alloc_resource(frozen_doc_type, sizeof(frozen_doc));
+  if (frozen == NULL) {
+    return make_error(env, "failed_to_alloc_resource");
+  }
+  frozen->doc = xmlCopyDoc(doc, 1);
+  if (frozen->doc == NULL) {
+    enif_release_resource(frozen);
+    return make_error(env, "failed_to_copy_document");
+  }
+  // precompute document order once, so sorting node sets compares indexes
+  // instead of walking the tree on every query
+  xmlXPathOrderDocElems(frozen->doc);
+
+  ERL_NIF_TERM term = enif_make_resource(env, frozen);
+  enif_release_resource(frozen);
+
+  return make_ok(env, term);
+}
+
+static ERL_NIF_TERM xpath_number_to_term(ErlNifEnv* env, double value) {
+  if (xmlXPathIsNaN(value)) {
+    return enif_make_atom(env, "nan");
+  }
+  switch (xmlXPathIsInf(value)) {
+  case 1:
+    return enif_make_atom(env, "infinity");
+  case -1:
+    return enif_make_atom(env, "neg_infinity");
+  }
+  return enif_make_double(env, value);
+}
+
+// Binaries below this size are copied onto the process heap anyway, and a
+// small slice should not pin a whole document in memory.
+#define ZERO_COPY_MIN_SIZE 64
+
+// The document's own storage for the string value of `node`, or NULL when the
+// value has to be built (mixed content, nested elements, entity references).
+static const xmlChar* frozen_node_content(xmlNodePtr node) {
+  switch (node->type) {
+  case XML_TEXT_NODE:
+  case XML_CDATA_SECTION_NODE:
+  case XML_COMMENT_NODE:
+  case XML_PI_NODE:
+    return node->content;
+  case XML_ELEMENT_NODE:
+  case XML_ATTRIBUTE_NODE:
+    if (node->children != NULL && node->children->next == NULL &&
+        (node->children->type == XML_TEXT_NODE || node->children->type == XML_CDATA_SECTION_NODE)) {
+      return node->children->content;
+    }
+    return NULL;
+  default:
+    return NULL;
+  }
+}
+
+// Materializes the result while the XPath object is still alive. Node sets
+// become lists of string values, which are copied unless `zero_copy` is set:
+// then large values stored verbatim in the document are returned as resource
+// binaries pointing into it, keeping the frozen document alive until they
+// are garbage collected. This is only safe because a frozen document is never
+// modified.
+static ERL_NIF_TERM xpath_object_to_term(ErlNifEnv* env, xmlXPathObjectPtr obj, frozen_doc* zero_copy) {
+  switch (obj->type) {
+  case XPATH_NODESET:
+    {
+      ERL_NIF_TERM list = enif_make_list(env, 0);
+      int count = obj->nodesetval == NULL ? 0 : obj->nodesetval->nodeNr;
+      for (int i = count - 1; i >= 0; i--) {
+        xmlNodePtr node = obj->nodesetval->nodeTab[i];
+        const xmlChar* content = zero_copy == NULL ? NULL : frozen_node_content(node);
+        size_t size = content == NULL ? 0 : strlen((const char*)content);
+        if (size >= ZERO_COPY_MIN_SIZE) {
+          ERL_NIF_TERM term = enif_make_resource_binary(env, zero_copy, content, size);
+          list = enif_make_list_cell(env, term, list);
+          continue;
+        }
+        xmlChar* value = xmlXPathCastNodeToString(node);
+        SET_STRING(term, (const char*)value);
+        xmlFree(value);
+        list = enif_make_list_cell(env, term, list);
+      }
+      return list;
+    }
+  case XPATH_BOOLEAN:
+    return enif_make_atom(env, obj->boolval ? "true" : "false");
+  case XPATH_NUMBER:
+    return xpath_number_to_term(env, obj->floatval);
+  case XPATH_STRING:
+    {
+      SET_STRING(term, (const char*)obj->stringval);
+      return term;
+    }
+  default:
+    return enif_make_atom(env, "nil");
+  }
+}
+
+static ERL_NIF_TERM xml_frozen_xpath_eval(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(frozen_doc, frozen, argv[0]);
+  GET_BINARY(strbin, argv[1]);
+  GET_INT(zero_copy, argv[2]);
+
+  // [uri, prefix, ...] for prefixes used in the expression
+  xmlChar** namespaces;
+  unsigned int namespaces_length;
+  const char* reason = get_xml_char_pp(env, argv[3], &namespaces, &namespaces_length);
+  if (reason != NULL) {
+    return make_error(env, reason);
+  }
+
+  xmlChar* xpath = binary_to_xml_char(&strbin);
+  if (xpath == NULL) {
+    free_xml_char_pp(namespaces, namespaces_length);
+    return make_error(env, "malloc_failed");
+  }
+
+  // contexts are cheap and never shared, the document is
+  xmlXPathContextPtr ctx = xmlXPathNewContext(frozen->doc);
+  if (ctx == NULL) {
+    xmlFree(xpath);
+    free_xml_char_pp(namespaces, namespaces_length);
+    return make_error(env, "failed_to_new_context");
+  }
+  for (unsigned int i = 0; i + 1 < namespaces_length; i += 2) {
+    if (xmlXPathRegisterNs(ctx, namespaces[i + 1], namespaces[i]) != 0) {
+      reason = "failed_to_register_namespace";
+      break;
+    }
+  }
+  free_xml_char_pp(namespaces, namespaces_length);
+  if (reason != NULL) {
+    xmlFree(xpath);
+    xmlXPathFreeContext(ctx);
+    return make_error(env, reason);
+  }
+
+  STATS_START(start);
+  xmlXPathObjectPtr obj = xmlXPathEval(xpath, ctx);
+  stats_record(STATS_XPATH_EVAL, start, strbin.size, obj == NULL);
+  xmlFree(xpath);
+  xmlXPathFreeContext(ctx);
+  if (obj == NULL) {
+    return make_error(env, "xpath_eval");
+  }
+
+  ERL_NIF_TERM result = xpath_object_to_term(env, obj, zero_copy ? frozen : NULL);
+  xmlXPathFreeObject(obj);
+
+  return make_ok(env, result);
+}
+
+static ERL_NIF_TERM get_xml_node(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlNodePtr, node, argv[0]);
+
+  //void           *_private;   /* application data */
+  //xmlElementType   type;      /* type number, must be second ! */
+  //const xmlChar   *name;      /* the name of the node, or the entity */
+  //struct _xmlNode *children;  /* parent->childs link */
+  //struct _xmlNode *last;      /* last child link */
+  //struct _xmlNode *parent;    /* child->parent link */
+  //struct _xmlNode *next;      /* next sibling link  */
+  //struct _xmlNode *prev;      /* previous sibling link  */
+  //struct _xmlDoc  *doc;       /* the containing document */
+
+  SET_POINTER_OR_NULL(private, node->_private);
+  SET_INT(type, node->type);
+  SET_POINTER_OR_NULL(name, node->name);
+  SET_POINTER_OR_NULL(children, node->children);
+  SET_POINTER_OR_NULL(last, node->last);
+  SET_POINTER_OR_NULL(parent, node->parent);
+  SET_POINTER_OR_NULL(next, node->next);
+  SET_POINTER_OR_NULL(prev, node->prev);
+  SET_POINTER_OR_NULL(doc, node->doc);
+
+  ERL_NIF_TERM map = enif_make_new_map(env);
+
+  PUT(map, private);
+  PUT(map, type);
+  PUT(map, name);
+  PUT(map, children);
+  PUT(map, last);
+  PUT(map, parent);
+  PUT(map, next);
+  PUT(map, prev);
+  PUT(map, doc);
+
+  switch (node->type) {
+  // special node types
+  case XML_ATTRIBUTE_NODE:
+    {
+      //xmlAttrPtr:
+      //xmlNs           *ns;        /* pointer to the associated namespace */
+      //xmlAttributeType atype;     /* the attribute type if validating */
+      //void            *psvi;      /* for type/PSVI informations */
+      return make_ok(env, map);
+    }
+  case XML_DTD_NODE:
+    {
+      //xmlDtdPtr:
+      //void          *notations;   /* Hash table for notations if any */
+      //void          *elements;    /* Hash table for elements if any */
+      //void          *attributes;  /* Hash table for attributes if any */
+      //void          *entities;    /* Hash table for entities if any */
+      //const xmlChar *ExternalID;  /* External identifier for PUBLIC DTD */
+      //const xmlChar *SystemID;    /* URI for a SYSTEM or PUBLIC DTD */
+      //void          *pentities;   /* Hash table for param entities if any */
+      return make_ok(env, map);
+    }
+  case XML_ELEMENT_DECL:
+    {
+      //xmlElementPtr:
+      //xmlElementTypeVal      etype;   /* The type */
+      //xmlElementContentPtr content;   /* the allowed element content */
+      //xmlAttributePtr   attributes;   /* List of the declared attributes */
+      //const xmlChar        *prefix;   /* the namespace prefix if any */
+      return make_ok(env, map);
+    }
+  case XML_ATTRIBUTE_DECL:
+    {
+      //xmlAttributePtr:
+      //struct _xmlAttribute  *nexth;   /* next in hash table */
+      //xmlAttributeType       atype;   /* The attribute type */
+      //xmlAttributeDefault      def;   /* the default */
+      //const xmlChar  *defaultValue;   /* or the default value */
+      //xmlEnumerationPtr       tree;       /* or the enumeration tree if any */
+      //const xmlChar        *prefix;   /* the namespace prefix if any */
+      //const xmlChar          *elem;   /* Element holding the attribute */
+      return make_ok(env, map);
+    }
+  case XML_DOCUMENT_NODE:
+    {
+      //xmlDocPtr:
+      //int             compression;/* level of zlib compression */
+      //int             standalone; /* standalone document (no external refs) 
+      //                                 1 if standalone="yes"
+      //                                 0 if standalone="no"
+      //                                -1 if there is no XML declaration
+      //                                -2 if there is an XML declaration, but no
+      //                                    standalone attribute was specified */
+      //struct _xmlDtd  *intSubset; /* the document internal subset */
+      //struct _xmlDtd  *extSubset; /* the document external subset */
+      //struct _xmlNs   *oldNs;     /* Global namespace, the old way */
+      //const xmlChar  *version;    /* the XML version string */
+      //const xmlChar  *encoding;   /* external initial encoding, if any */
+      //void           *ids;        /* Hash table for ID attributes if any */
+      //void           *refs;       /* Hash table for IDREFs attributes if any */
+      //const xmlChar  *URL;        /* The URI for that document */
+      //int             charset;    /* encoding of the in-memory content
+      //                               actually an xmlCharEncoding */
+      //struct _xmlDict *dict;      /* dict used to allocate names or NULL */
+      //void           *psvi;       /* for type/PSVI informations */
+      //int             parseFlags; /* set of xmlParserOption used to parse the
+      //                               document */
+      //int             properties; /* set of xmlDocProperties for this document
+      //                               set at the end of parsing */
+      return make_ok(env, map);
+    }
+  default:
+    break;
+  }
+
+  //xmlNs           *ns;        /* pointer to the associated namespace */
+  //xmlChar         *content;   /* the content */
+  //struct _xmlAttr *properties;/* properties list */
+  //xmlNs           *nsDef;     /* namespace definitions on this node */
+  //void            *psvi;      /* for type/PSVI informations */
+  //unsigned short   line;      /* line number */
+  //unsigned short   extra;     /* extra data for XPath/XSLT */
+  SET_POINTER_OR_NULL(ns, node->ns);
+  SET_POINTER_OR_NULL(content, node->content);
+  SET_POINTER_OR_NULL(properties, node->properties);
+  SET_POINTER_OR_NULL(ns_def, node->nsDef);
+  SET_INT(line, node->line);
+
+  PUT(map, ns);
+  PUT(map, content);
+  PUT(map, properties);
+  PUT(map, ns_def);
+  PUT(map, line);
+
+  return make_ok(env, map);
+}
+
+static ERL_NIF_TERM set_xml_node(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlNodePtr, p, argv[0]);
+  ERL_NIF_TERM map = argv[1];
+
+  GET(map, private);
+  GET(map, type);
+  GET(map, name);
+  GET(map, children);
+  GET(map, last);
+  GET(map, parent);
+  GET(map, next);
+  GET(map, prev);
+  GET(map, doc);
+
+  GET_POINTER_OR_NULL(void*, private2, private);
+  GET_INT(type2, type);
+  GET_POINTER_OR_NULL(const xmlChar*, name2, name);
+  GET_POINTER_OR_NULL(xmlNodePtr, children2, children);
+  GET_POINTER_OR_NULL(xmlNodePtr, last2, last);
+  GET_POINTER_OR_NULL(xmlNodePtr, parent2, parent);
+  GET_POINTER_OR_NULL(xmlNodePtr, next2, next);
+  GET_POINTER_OR_NULL(xmlNodePtr, prev2, prev);
+  GET_POINTER_OR_NULL(xmlDocPtr, doc2, doc);
+
+  p->_private = private2;
+  p->type = type2;
+  p->name = name2;
+  p->children = children2;
+  p->last = last2;
+  p->parent = parent2;
+  p->next = next2;
+  p->prev = prev2;
+  p->doc = doc2;
+
+  switch (p->type) {
+  // special node types
+  case XML_ATTRIBUTE_NODE:
+  case XML_DTD_NODE:
+  case XML_ELEMENT_DECL:
+  case XML_ATTRIBUTE_DECL:
+  case XML_DOCUMENT_NODE:
+    return enif_make_atom(env, "ok");
+  default:
+    break;
+  }
+
+  GET(map, ns);
+  GET(map, content);
+  GET(map, properties);
+  GET(map, ns_def);
+  GET(map, line);
+
+  GET_POINTER_OR_NULL(xmlNsPtr, ns2, ns);
+  GET_POINTER_OR_NULL(xmlChar*, content2, content);
+  GET_POINTER_OR_NULL(xmlAttrPtr, properties2, properties);
+  GET_POINTER_OR_NULL(xmlNsPtr, ns_def2, ns_def);
+  GET_INT(line2, line);
+
+  p->ns = ns2;
+  p->content = content2;
+  p->properties = properties2;
+  p->nsDef = ns_def2;
+
+  return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM get_xml_char(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlChar*, str, argv[0]);
+
+  ErlNifBinary bin;
+  int ret = enif_alloc_binary(strlen((const char*)str), &bin);
+  if (ret == 0) {
+    return make_error(env, "bad_alloc");
+  }
+  memcpy(bin.data, str, bin.size);
+
+  return make_ok(env, enif_make_binary(env, &bin));
+}
+
+static ERL_NIF_TERM get_xml_ns(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlNsPtr, ns, argv[0]);
+
+  ERL_NIF_TERM map = enif_make_new_map(env);
+
+  SET_POINTER_OR_NULL(next, ns->next);
+  SET_POINTER_OR_NULL(href, ns->href);
+  SET_POINTER_OR_NULL(prefix, ns->prefix);
+
+  PUT(map, next);
+  PUT(map, href);
+  PUT(map, prefix);
+
+  return make_ok(env, map);
+}
+
+static ERL_NIF_TERM get_xml_xpath_context(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlXPathContextPtr, p, argv[0]);
+
+  ERL_NIF_TERM map = enif_make_new_map(env);
+
+  SET_POINTER(doc, p->doc);
+  SET_POINTER_OR_NULL(node, p->node);
+
+  PUT(map, doc);
+  PUT(map, node);
+
+  return make_ok(env, map);
+}
+
+static ERL_NIF_TERM set_xml_xpath_context(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlXPathContextPtr, p, argv[0]);
+  ERL_NIF_TERM map = argv[1];
+
+  GET(map, doc);
+  GET(map, node);
+
+  GET_POINTER(xmlDocPtr, doc2, doc);
+  GET_POINTER_OR_NULL(xmlNodePtr, node2, node);
+
+  p->doc = doc2;
+  p->node = node2;
+
+  return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM get_xml_xpath_object(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlXPathObjectPtr, p, argv[0]);
+
+  //xmlXPathObjectType type;
+  //xmlNodeSetPtr nodesetval;
+  //int boolval;
+  //double floatval;
+  //xmlChar *stringval;
+  //void *user;
+  //int index;
+  //void *user2;
+  //int index2;
+
+  ERL_NIF_TERM map = enif_make_new_map(env);
+
+  SET_INT(type, p->type);
+  PUT(map, type);
+
+  switch (p->type) {
+  case XPATH_UNDEFINED:
+    break;
+  case XPATH_NODESET:
+  case XPATH_XSLT_TREE:
+    {
+      SET_POINTER_OR_NULL(nodesetval, p->nodesetval);
+      PUT(map, nodesetval);
+      // lets callers size the set without listing every node
+      SET_INT(node_nr, p->nodesetval == NULL ? 0 : p->nodesetval->nodeNr);
+      PUT(map, node_nr);
+    }
+    break;
+  case XPATH_BOOLEAN:
+    {
+      SET_INT(boolval, p->boolval);
+      PUT(map, boolval);
+    }
+    break;
+  case XPATH_NUMBER:
+    {
+      SET_DOUBLE(floatval, p->floatval);
+      PUT(map, floatval);
+    }
+    break;
+  case XPATH_STRING:
+    {
+      SET_POINTER_OR_NULL(stringval, p->stringval);
+      PUT(map, stringval);
+    }
+    break;
+  case XPATH_POINT:
+    {
+      SET_INT(index, p->index);
+      SET_POINTER_OR_NULL(user, p->user);
+      PUT(map, index);
+      PUT(map, user);
+    }
+    break;
+  case XPATH_RANGE:
+    {
+      SET_INT(index, p->index);
+      SET_INT(index2, p->index2);
+      SET_POINTER_OR_NULL(user, p->user);
+      SET_POINTER_OR_NULL(user2, p->user2);
+      PUT(map, index);
+      PUT(map, index2);
+      PUT(map, user);
+      PUT(map, user2);
+    }
+    break;
+  case XPATH_LOCATIONSET:
+    {
+      SET_POINTER_OR_NULL(user, p->user);
+      PUT(map, user);
+    }
+    break;
+  case XPATH_USERS:
+    break;
+  }
+  return make_ok(env, map);
+}
+
+static ERL_NIF_TERM get_xml_node_set(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlNodeSetPtr, p, argv[0]);
+
+  //int nodeNr;                 /* number of nodes in the set */
+  //int nodeMax;                /* size of the array as allocated */
+  //xmlNodePtr *nodeTab;        /* array of nodes in no particular order */
+  ///* @@ with_ns to check wether namespace nodes should be looked at @@ */
+
+  ERL_NIF_TERM map = enif_make_new_map(env);
+
+  SET_INT(node_nr, p->nodeNr);
+  SET_INT(node_max, p->nodeMax);
+
+  ERL_NIF_TERM nodes = enif_make_list(env, 0);
+  for (int i = p->nodeNr - 1; i >= 0; i--) {
+    SET_POINTER(node_tab, p->nodeTab[i]);
+    nodes = enif_make_list_cell(env, node_tab, nodes);
+  }
+  PUT(map, node_nr);
+  PUT(map, node_max);
+  PUT(map, nodes);
+
+  return make_ok(env, map);
+}
+
+// prefix:name, or name when the node has no namespace prefix
+static ERL_NIF_TERM make_qname(ErlNifEnv* env, xmlNsPtr ns, const xmlChar* name) {
+  size_t prefix_len = ns == NULL || ns->prefix == NULL ? 0 : strlen((const char*)ns->prefix);
+  size_t name_len = strlen((const char*)name);
+  ERL_NIF_TERM term;
+  unsigned char* buf = enif_make_new_binary(env, prefix_len == 0 ? name_len : prefix_len + 1 + name_len, &term);
+  if (prefix_len != 0) {
+    memcpy(buf, ns->prefix, prefix_len);
+    buf[prefix_len] = ':';
+    buf += prefix_len + 1;
+  }
+  memcpy(buf, name, name_len);
+  return term;
+}
+
+static ERL_NIF_TERM make_content(ErlNifEnv* env, xmlNodePtr node) {
+  xmlChar* value = xmlNodeGetContent(node);
+  SET_STRING(term, (const char*)value);
+  xmlFree(value);
+  return term;
+}
+
+static ERL_NIF_TERM attributes_to_term(ErlNifEnv* env, xmlNodePtr node) {
+  ERL_NIF_TERM list = enif_make_list(env, 0);
+  if (node->type == XML_ATTRIBUTE_NODE) {
+    ERL_NIF_TERM attr = enif_make_tuple2(env, make_qname(env, node->ns, node->name), make_content(env, node));
+    return enif_make_list_cell(env, attr, list);
+  }
+  if (node->type != XML_ELEMENT_NODE) {
+    return list;
+  }
+  for (xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) {
+    ERL_NIF_TERM name = make_qname(env, attr->ns, attr->name);
+    list = enif_make_list_cell(env, enif_make_tuple2(env, name, make_content(env, (xmlNodePtr)attr)), list);
+  }
+  enif_make_reverse_list(env, list, &list);
+  return list;
+}
+
+// The inverse of term_to_xml_node: elements become
+// {name, [{attr_name, attr_value}], children} and text or CDATA becomes a
+// binary. Other node kinds are dropped from children and are nil at the top.
+// Returns 0, or -1 when the subtree is deeper than MAX_TREE_DEPTH.
+static int xml_node_to_term(ErlNifEnv* env, xmlNodePtr node, int depth, ERL_NIF_TERM* term) {
+  if (depth > MAX_TREE_DEPTH) {
+    return -1;
+  }
+
+  switch (node->type) {
+  case XML_TEXT_NODE:
+  case XML_CDATA_SECTION_NODE:
+    {
+      SET_STRING(content, (const char*)node->content);
+      *term = content;
+      return 0;
+    }
+  case XML_ATTRIBUTE_NODE:
+    *term = enif_make_tuple2(env, make_qname(env, node->ns, node->name), make_content(env, node));
+    return 0;
+  case XML_DOCUMENT_NODE:
+    node = xmlDocGetRootElement((xmlDocPtr)node);
+    if (node == NULL) {
+      break;
+    }
+    return xml_node_to_term(env, node, depth, term);
+  case XML_ELEMENT_NODE:
+    {
+      ERL_NIF_TERM children = enif_make_list(env, 0);
+      for (xmlNodePtr child = node->children; child != NULL; child = child->next) {
+        if (child->type != XML_ELEMENT_NODE && child->type != XML_TEXT_NODE &&
+            child->type != XML_CDATA_SECTION_NODE) {
+          continue;
+        }
+        ERL_NIF_TERM child_term;
+        if (xml_node_to_term(env, child, depth + 1, &child_term) < 0) {
+          return -1;
+        }
+        children = enif_make_list_cell(env, child_term, children);
+      }
+      enif_make_reverse_list(env, children, &children);
+
+      *term = enif_make_tuple3(env, make_qname(env, node->ns, node->name), attributes_to_term(env, node), children);
+      return 0;
+    }
+  default:
+    break;
+  }
+
+  *term = enif_make_atom(env, "nil");
+  return 0;
+}
+
+// Returns count nodes of the set starting at offset, so large node sets can
+// be consumed in bounded pages. mode selects how each node is returned:
+//   0: pointer
+//   1: string value
+//   2: attributes as [{name, value}]
+//   3: subtree term, see xml_node_to_term
+// The cursor is just the offset. The set belongs to an XPath object, and its
+// nodes to a document, both freed explicitly through their pointer handles;
+// a cursor resource could outlive them and would be no safer than an offset.
+static ERL_NIF_TERM get_xml_node_set_page(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlNodeSetPtr, p, argv[0]);
+  GET_INT(offset, argv[1]);
+  GET_INT(count, argv[2]);
+  GET_INT(mode, argv[3]);
+  if (offset < 0 || count < 0 || mode < 0 || mode > 3) {
+    return enif_make_badarg(env);
+  }
+
+  int end = count > p->nodeNr - offset ? p->nodeNr : offset + count;
+
+  ERL_NIF_TERM nodes = enif_make_list(env, 0);
+  for (int i = end - 1; i >= offset; i--) {
+    xmlNodePtr node = p->nodeTab[i];
+    ERL_NIF_TERM term;
+    switch (mode) {
+    case 0:
+      {
+        SET_POINTER(ptr, node);
+        term = ptr;
+      }
+      break;
+    case 1:
+      {
+        xmlChar* value = xmlXPathCastNodeToString(node);
+        SET_STRING(str, (const char*)value);
+        xmlFree(value);
+        term = str;
+      }
+      break;
+    case 2:
+      term = attributes_to_term(env, node);
+      break;
+    default:
+      if (xml_node_to_term(env, node, 0, &term) < 0) {
+        return make_error(env, "max_depth_exceeded");
+      }
+      break;
+    }
+    nodes = enif_make_list_cell(env, term, nodes);
+  }
+
+  return make_ok(env, nodes);
+}
+
+typedef struct _slist {
+  ERL_NIF_TERM data;
+  struct _slist* next;
+} slist;
+
+typedef struct {
+  ErlNifEnv* env;
+  slist* list;
+} structured_data;
+
+static ERL_NIF_TERM error_to_term(ErlNifEnv* env, xmlErrorPtr error) {
+  // int         domain; /* What part of the library raised this error */
+  // int         code;   /* The error code, e.g. an xmlParserError */
+  // char       *message;/* human-readable informative error message */
+  // xmlErrorLevel level;/* how consequent is the error */
+  // char       *file;   /* the filename */
+  // int         line;   /* the line number if available */
+  // char       *str1;   /* extra string information */
+  // char       *str2;   /* extra string information */
+  // char       *str3;   /* extra string information */
+  // int         int1;   /* extra number information */
+  // int         int2;   /* error column # or 0 if N/A (todo: rename field when we would brk ABI) */
+  // void       *ctxt;   /* the parser context if available */
+  // void       *node;   /* the node in the tree */
+  SET_INT(domain, error->domain);
+  SET_INT(code, error->code);
+  SET_STRING(message, error->message);
+  SET_INT(level, error->level);
+  SET_STRING(file, error->file);
+  SET_INT(line, error->line);
+  SET_STRING(str1, error->str1);
+  SET_STRING(str2, error->str2);
+  SET_STRING(str3, error->str3);
+  SET_INT(int1, error->int1);
+  SET_INT(int2, error->int2);
+
+  ERL_NIF_TERM map = enif_make_new_map(env);
+
+  // ignore put errors
+  enif_make_map_put(env, map, enif_make_atom(env, "domain"), domain, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "code"), code, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "message"), message, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "level"), level, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "file"), file, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "line"), line, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "str1"), str1, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "str2"), str2, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "str3"), str3, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "int1"), int1, &map);
+  enif_make_map_put(env, map, enif_make_atom(env, "int2"), int2, &map);
+
+  return map;
+}
+
+static void structured_error(void* userData, xmlErrorPtr error) {
+  structured_data* data = (structured_data*)userData;
+  ErlNifEnv* env = data->env;
+
+  slist* ptr = (slist*)xmlMalloc(sizeof(slist));
+  ptr->data = error_to_term(env, error);
+  ptr->next = data->list;
+  data->list = ptr;
+}
+
+static ERL_NIF_TERM structured_get_result(ErlNifEnv* env, structured_data* sd) {
+  slist* p = sd->list;
+  ERL_NIF_TERM xs = enif_make_list(env, 0);
+  while (p != NULL) {
+    xs = enif_make_list_cell(env, p->data, xs);
+    slist* next = p->next;
+    xmlFree(p);
+    p = next;
+  }
+  return xs;
+}
+
+
+static ERL_NIF_TERM xml_schema_new_parser_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(url, argv[0]);
+
+  char* urlstr = (char*)xmlMalloc(url.size + 1);
+  if (urlstr == NULL) {
+    return make_error(env, "malloc_failed");
+  }
+  memcpy(urlstr, url.data, url.size);
+  urlstr[url.size] = '\0';
+
+  xmlSchemaParserCtxtPtr ctxt = xmlSchemaNewParserCtxt(urlstr);
+
+  xmlFree(urlstr);
+
+  SET_POINTER(ptr, ctxt);
+
+  return make_ok(env, ptr);
+}
+static ERL_NIF_TERM xml_schema_new_doc_parser_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  xmlSchemaParserCtxtPtr ctxt = xmlSchemaNewDocParserCtxt(doc);
+  SET_POINTER(ptr, ctxt);
+  return make_ok(env, ptr);
+}
+static ERL_NIF_TERM xml_schema_parse(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlSchemaParserCtxtPtr, ctxt, argv[0]);
+
+  structured_data sd = { env, NULL };
+  xmlSchemaSetParserStructuredErrors(ctxt, structured_error, &sd);
+  // includes and imports are loaded on their own parser contexts, which
+  // report I/O and loader errors through the global handler
+  xmlSetStructuredErrorFunc(&sd, structured_error);
+
+  STATS_START(start);
+  xmlSchemaPtr schema = xmlSchemaParse(ctxt);
+  stats_record(STATS_SCHEMA_PARSE, start, 0, schema == NULL);
+
+  xmlSetStructuredErrorFunc(NULL, NULL);
+
+  xmlSchemaSetParserStructuredErrors(ctxt, NULL, NULL);
+
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  SET_POINTER_OR_NULL(ptr, schema);
+  return make_ok(env, enif_make_tuple2(env, ptr, xs));
+}
+// Parses and compiles a schema held in memory in one call, so the buffer only
+// has to stay valid for the duration of the NIF.
+static ERL_NIF_TERM xml_schema_parse_memory(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(buffer, argv[0]);
+
+  xmlSchemaParserCtxtPtr ctxt = xmlSchemaNewMemParserCtxt((const char*)buffer.data, buffer.size);
+  if (ctxt == NULL) {
+    return make_error(env, "failed_to_new_mem_parser_ctxt");
+  }
+
+  structured_data sd = { env, NULL };
+  xmlSchemaSetParserStructuredErrors(ctxt, structured_error, &sd);
+  xmlSetStructuredErrorFunc(&sd, structured_error);
+
+  STATS_START(start);
+  xmlSchemaPtr schema = xmlSchemaParse(ctxt);
+  stats_record(STATS_SCHEMA_PARSE, start, buffer.size, schema == NULL);
+
+  xmlSetStructuredErrorFunc(NULL, NULL);
+
+  xmlSchemaFreeParserCtxt(ctxt);
+
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  SET_POINTER_OR_NULL(ptr, schema);
+  return make_ok(env, enif_make_tuple2(env, ptr, xs));
+}
+static ERL_NIF_TERM xml_schema_new_valid_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlSchemaPtr, schema, argv[0]);
+  xmlSchemaValidCtxtPtr ctxt = xmlSchemaNewValidCtxt(schema);
+  SET_POINTER(ptr, ctxt);
+  return make_ok(env, ptr);
+}
+
+static ERL_NIF_TERM xml_schema_validate_doc(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlSchemaValidCtxtPtr, ctxt, argv[0]);
+  GET_POINTER(xmlDocPtr, instance, argv[1]);
+
+  structured_data sd = { env, NULL };
+  xmlSchemaSetValidStructuredErrors(ctxt, structured_error, &sd);
+
+  STATS_START(start);
+  int result = xmlSchemaValidateDoc(ctxt, instance);
+  stats_record(STATS_SCHEMA_VALIDATE, start, 0, result != 0);
+
+  xmlSchemaSetValidStructuredErrors(ctxt, NULL, NULL);
+
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  SET_INT(value, result);
+  return make_ok(env, enif_make_tuple2(env, value, xs));
+}
+static ERL_NIF_TERM xml_schema_free_parser_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlSchemaParserCtxtPtr, ctxt, argv[0]);
+  xmlSchemaFreeParserCtxt(ctxt);
+  return enif_make_atom(env, "ok");
+}
+static ERL_NIF_TERM xml_schema_free(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlSchemaPtr, schema, argv[0]);
+  xmlSchemaFree(schema);
+  return enif_make_atom(env, "ok");
+}
+static ERL_NIF_TERM xml_schema_free_valid_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlSchemaValidCtxtPtr, ctxt, argv[0]);
+  xmlSchemaFreeValidCtxt(ctxt);
+  return enif_make_atom(env, "ok");
+}
+
+// Compiled Relax NG grammars and parsed DTDs are resources: a grammar is
+// compiled once and shared by every process validating against it, so no
+// single caller can tell when it is safe to free. Parser and validation
+// contexts are resources too, so they cannot outlive the grammar they use.
+// libxml2 contexts keep per-call state, so each one carries a mutex.
+typedef struct {
+  ErlNifMutex* mutex;
+  xmlRelaxNGParserCtxtPtr ctxt;
+} relaxng_parser_ctxt;
+
+typedef struct {
+  xmlRelaxNGPtr schema;
+} relaxng_schema;
+
+typedef struct {
+  ErlNifMutex* mutex;
+  xmlRelaxNGValidCtxtPtr ctxt;
+  // kept alive for as long as the context validates against it
+  relaxng_schema* schema;
+} relaxng_valid_ctxt;
+
+static ErlNifResourceType* relaxng_parser_ctxt_type = NULL;
+static ErlNifResourceType* relaxng_schema_type = NULL;
+static ErlNifResourceType* relaxng_valid_ctxt_type = NULL;
+
+static void relaxng_parser_ctxt_dtor(ErlNifEnv* env, void* obj) {
+  relaxng_parser_ctxt* parser = (relaxng_parser_ctxt*)obj;
+  if (parser->ctxt != NULL) {
+    xmlRelaxNGFreeParserCtxt(parser->ctxt);
+  }
+  if (parser->mutex != NULL) {
+    enif_mutex_destroy(parser->mutex);
+  }
+}
+
+static void relaxng_schema_dtor(ErlNifEnv* env, void* obj) {
+  relaxng_schema* grammar = (relaxng_schema*)obj;
+  if (grammar->schema != NULL) {
+    xmlRelaxNGFree(grammar->schema);
+  }
+}
+
+static void relaxng_valid_ctxt_dtor(ErlNifEnv* env, void* obj) {
+  relaxng_valid_ctxt* valid = (relaxng_valid_ctxt*)obj;
+  if (valid->ctxt != NULL) {
+    xmlRelaxNGFreeValidCtxt(valid->ctxt);
+  }
+  if (valid->mutex != NULL) {
+    enif_mutex_destroy(valid->mutex);
+  }
+  if (valid->schema != NULL) {
+    enif_release_resource(valid->schema);
+  }
+}
+
+static ERL_NIF_TERM make_relaxng_parser_ctxt(ErlNifEnv* env, xmlRelaxNGParserCtxtPtr ctxt) {
+  if (ctxt == NULL) {
+    return make_error(env, "failed_to_new_parser_ctxt");
+  }
+  relaxng_parser_ctxt* parser = (relaxng_parser_ctxt*)enif_alloc_resource(relaxng_parser_ctxt_type, sizeof(relaxng_parser_ctxt));
+  if (parser == NULL) {
+    xmlRelaxNGFreeParserCtxt(ctxt);
+    return make_error(env, "failed_to_alloc_resource");
+  }
+  parser->ctxt = ctxt;
+  parser->mutex = enif_mutex_create((char*)"libxml_relaxng_parser_ctxt");
+  if (parser->mutex == NULL) {
+    enif_release_resource(parser);
+    return make_error(env, "failed_to_create_mutex");
+  }
+
+  ERL_NIF_TERM term = enif_make_resource(env, parser);
+  enif_release_resource(parser);
+
+  return make_ok(env, term);
+}
+
+// nil when parsing failed, the errors say why
+static ERL_NIF_TERM make_relaxng_schema(ErlNifEnv* env, xmlRelaxNGPtr schema) {
+  if (schema == NULL) {
+    return enif_make_atom(env, "nil");
+  }
+  relaxng_schema* grammar = (relaxng_schema*)enif_alloc_resource(relaxng_schema_type, sizeof(relaxng_schema));
+  if (grammar == NULL) {
+    xmlRelaxNGFree(schema);
+    return enif_make_atom(env, "nil");
+  }
+  grammar->schema = schema;
+
+  ERL_NIF_TERM term = enif_make_resource(env, grammar);
+  enif_release_resource(grammar);
+
+  return term;
+}
+
+static ERL_NIF_TERM xml_relaxng_new_parser_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(url, argv[0]);
+
+  char* urlstr = (char*)binary_to_xml_char(&url);
+  if (urlstr == NULL) {
+    return make_error(env, "malloc_failed");
+  }
+
+  xmlRelaxNGParserCtxtPtr ctxt = xmlRelaxNGNewParserCtxt(urlstr);
+
+  xmlFree(urlstr);
+
+  return make_relaxng_parser_ctxt(env, ctxt);
+}
+static ERL_NIF_TERM xml_relaxng_new_doc_parser_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  // the context works on its own copy of doc
+  return make_relaxng_parser_ctxt(env, xmlRelaxNGNewDocParserCtxt(doc));
+}
+static ERL_NIF_TERM xml_relaxng_parse(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(relaxng_parser_ctxt, parser, argv[0]);
+
+  structured_data sd = { env, NULL };
+  enif_mutex_lock(parser->mutex);
+  xmlRelaxNGSetParserStructuredErrors(parser->ctxt, structured_error, &sd);
+
+  STATS_START(start);
+  xmlRelaxNGPtr schema = xmlRelaxNGParse(parser->ctxt);
+  stats_record(STATS_RELAXNG_PARSE, start, 0, schema == NULL);
+
+  xmlRelaxNGSetParserStructuredErrors(parser->ctxt, NULL, NULL);
+  enif_mutex_unlock(parser->mutex);
+
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  return make_ok(env, enif_make_tuple2(env, make_relaxng_schema(env, schema), xs));
+}
+// Same as xml_schema_parse_memory, the buffer only has to outlive the call.
+static ERL_NIF_TERM xml_relaxng_parse_memory(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(buffer, argv[0]);
+
+  xmlRelaxNGParserCtxtPtr ctxt = xmlRelaxNGNewMemParserCtxt((const char*)buffer.data, buffer.size);
+  if (ctxt == NULL) {
+    return make_error(env, "failed_to_new_mem_parser_ctxt");
+  }
+
+  structured_data sd = { env, NULL };
+  xmlRelaxNGSetParserStructuredErrors(ctxt, structured_error, &sd);
+
+  STATS_START(start);
+  xmlRelaxNGPtr schema = xmlRelaxNGParse(ctxt);
+  stats_record(STATS_RELAXNG_PARSE, start, buffer.size, schema == NULL);
+
+  xmlRelaxNGFreeParserCtxt(ctxt);
+
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  return make_ok(env, enif_make_tuple2(env, make_relaxng_schema(env, schema), xs));
+}
+static ERL_NIF_TERM xml_relaxng_new_valid_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(relaxng_schema, grammar, argv[0]);
+
+  relaxng_valid_ctxt* valid = (relaxng_valid_ctxt*)enif_alloc_resource(relaxng_valid_ctxt_type, sizeof(relaxng_valid_ctxt));
+  if (valid == NULL) {
+    return make_error(env, "failed_to_alloc_resource");
+  }
+  valid->schema = grammar;
+  enif_keep_resource(grammar);
+  valid->ctxt = xmlRelaxNGNewValidCtxt(grammar->schema);
+  valid->mutex = enif_mutex_create((char*)"libxml_relaxng_valid_ctxt");
+  if (valid->ctxt == NULL || valid->mutex == NULL) {
+    enif_release_resource(valid);
+    return make_error(env, "failed_to_new_valid_ctxt");
+  }
+
+  ERL_NIF_TERM term = enif_make_resource(env, valid);
+  enif_release_resource(valid);
+
+  return make_ok(env, term);
+}
+static ERL_NIF_TERM xml_relaxng_validate_doc(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(relaxng_valid_ctxt, valid, argv[0]);
+  GET_POINTER(xmlDocPtr, instance, argv[1]);
+
+  structured_data sd = { env, NULL };
+  enif_mutex_lock(valid->mutex);
+  xmlRelaxNGSetValidStructuredErrors(valid->ctxt, structured_error, &sd);
+
+  STATS_START(start);
+  int result = xmlRelaxNGValidateDoc(valid->ctxt, instance);
+  stats_record(STATS_RELAXNG_VALIDATE, start, 0, result != 0);
+
+  xmlRelaxNGSetValidStructuredErrors(valid->ctxt, NULL, NULL);
+  enif_mutex_unlock(valid->mutex);
+
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  SET_INT(value, result);
+  return make_ok(env, enif_make_tuple2(env, value, xs));
+}
+
+// A parsed DTD, shared like a compiled Relax NG grammar.
+typedef struct {
+  xmlDtdPtr dtd;
+} parsed_dtd;
+
+static ErlNifResourceType* parsed_dtd_type = NULL;
+
+static void parsed_dtd_dtor(ErlNifEnv* env, void* obj) {
+  parsed_dtd* resource = (parsed_dtd*)obj;
+  if (resource->dtd != NULL) {
+    xmlFreeDtd(resource->dtd);
+  }
+}
+
+static void dtd_build_content_model(void* payload, void* data, xmlChar* name) {
+  xmlValidBuildContentModel((xmlValidCtxtPtr)data, (xmlElementPtr)payload);
+}
+
+// Element content models are otherwise compiled lazily on first use, by
+// whichever validation gets there first. Building them up front means
+// validation only ever reads the DTD, so processes can share it.
+// nil when parsing failed, the errors say why.
+static ERL_NIF_TERM make_dtd(ErlNifEnv* env, xmlDtdPtr parsed) {
+  if (parsed == NULL) {
+    return enif_make_atom(env, "nil");
+  }
+  xmlValidCtxtPtr ctxt = xmlNewValidCtxt();
+  parsed_dtd* resource = ctxt == NULL ? NULL : (parsed_dtd*)enif_alloc_resource(parsed_dtd_type, sizeof(parsed_dtd));
+  if (resource == NULL) {
+    if (ctxt != NULL) {
+      xmlFreeValidCtxt(ctxt);
+    }
+    xmlFreeDtd(parsed);
+    return enif_make_atom(env, "nil");
+  }
+  resource->dtd = parsed;
+  if (parsed->elements != NULL) {
+    ctxt->error = NULL;
+    ctxt->warning = NULL;
+    xmlHashScan((xmlHashTablePtr)parsed->elements, dtd_build_content_model, ctxt);
+  }
+  xmlFreeValidCtxt(ctxt);
+
+  ERL_NIF_TERM term = enif_make_resource(env, resource);
+  enif_release_resource(resource);
+
+  return term;
+}
+
+// DTD parsing and validation have no per-context structured error hook, so
+// errors are collected through the structured error handler, which libxml2
+// keeps per thread.
+static ERL_NIF_TERM xml_dtd_parse_file(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(path, argv[0]);
+
+  xmlChar* pathstr = binary_to_xml_char(&path);
+  if (pathstr == NULL) {
+    return make_error(env, "malloc_failed");
+  }
+
+  structured_data sd = { env, NULL };
+  xmlSetStructuredErrorFunc(&sd, structured_error);
+
+  STATS_START(start);
+  xmlDtdPtr parsed = xmlParseDTD(NULL, pathstr);
+  stats_record(STATS_DTD_PARSE, start, 0, parsed == NULL);
+
+  ERL_NIF_TERM term = make_dtd(env, parsed);
+  xmlSetStructuredErrorFunc(NULL, NULL);
+  xmlFree(pathstr);
+
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  return make_ok(env, enif_make_tuple2(env, term, xs));
 }
+static ERL_NIF_TERM xml_dtd_parse_memory(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(buffer, argv[0]);
 
-static ERL_NIF_TERM get_xml_node_set(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlNodeSetPtr, p, argv[0]);
+  xmlParserInputBufferPtr input = xmlParserInputBufferCreateMem((const char*)buffer.data, buffer.size, XML_CHAR_ENCODING_NONE);
+  if (input == NULL) {
+    return make_error(env, "failed_to_create_input_buffer");
+  }
 
-  //int nodeNr;                 /* number of nodes in the set */
-  //int nodeMax;                /* size of the array as allocated */
-  //xmlNodePtr *nodeTab;        /* array of nodes in no particular order */
-  ///* @@ with_ns to check wether namespace nodes should be looked at @@ */
+  structured_data sd = { env, NULL };
+  xmlSetStructuredErrorFunc(&sd, structured_error);
 
-  ERL_NIF_TERM map = enif_make_new_map(env);
+  // xmlIOParseDTD frees input
+  STATS_START(start);
+  xmlDtdPtr parsed = xmlIOParseDTD(NULL, input, XML_CHAR_ENCODING_NONE);
+  stats_record(STATS_DTD_PARSE, start, buffer.size, parsed == NULL);
 
-  SET_INT(node_nr, p->nodeNr);
-  SET_INT(node_max, p->nodeMax);
+  ERL_NIF_TERM term = make_dtd(env, parsed);
+  xmlSetStructuredErrorFunc(NULL, NULL);
 
-  ERL_NIF_TERM nodes = enif_make_list(env, 0);
-  for (int i = p->nodeNr - 1; i >= 0; i--) {
-    SET_POINTER(node_tab, p->nodeTab[i]);
-    nodes = enif_make_list_cell(env, node_tab, nodes);
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  return make_ok(env, enif_make_tuple2(env, term, xs));
+}
+static ERL_NIF_TERM xml_validate_dtd(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(parsed_dtd, resource, argv[0]);
+  GET_POINTER(xmlDocPtr, doc, argv[1]);
+
+  xmlValidCtxtPtr ctxt = xmlNewValidCtxt();
+  if (ctxt == NULL) {
+    return make_error(env, "failed_to_new_valid_ctxt");
   }
-  PUT(map, node_nr);
-  PUT(map, node_max);
-  PUT(map, nodes);
+  // silence the default stderr reporting, errors arrive structured instead
+  ctxt->error = NULL;
+  ctxt->warning = NULL;
 
-  return make_ok(env, map);
+  structured_data sd = { env, NULL };
+  xmlSetStructuredErrorFunc(&sd, structured_error);
+
+  // xmlValidateDtd frees doc->ids and doc->refs and rebuilds them from the
+  // DTD being validated against, which would break later ID lookups on the
+  // document. Validate with empty tables and put the originals back.
+  xmlIDTablePtr ids = (xmlIDTablePtr)doc->ids;
+  xmlRefTablePtr refs = (xmlRefTablePtr)doc->refs;
+  doc->ids = NULL;
+  doc->refs = NULL;
+
+  STATS_START(start);
+  int valid = xmlValidateDtd(ctxt, doc, resource->dtd);
+  stats_record(STATS_DTD_VALIDATE, start, 0, !valid);
+
+  if (doc->ids != NULL) {
+    xmlFreeIDTable((xmlIDTablePtr)doc->ids);
+  }
+  if (doc->refs != NULL) {
+    xmlFreeRefTable((xmlRefTablePtr)doc->refs);
+  }
+  doc->ids = ids;
+  doc->refs = refs;
+
+  xmlSetStructuredErrorFunc(NULL, NULL);
+  xmlFreeValidCtxt(ctxt);
+
+  // 0 when valid, like xml_schema_validate_doc
+  ERL_NIF_TERM xs = structured_get_result(env, &sd);
+  SET_INT(value, valid ? 0 : 1);
+  return make_ok(env, enif_make_tuple2(env, value, xs));
 }
 
+// A compiled stylesheet is immutable once parsed, so one resource can be
+// applied from any number of processes concurrently. It is freed when the
+// last reference is garbage collected.
+typedef struct {
+  xsltStylesheetPtr style;
+} xslt_stylesheet;
 
+static ErlNifResourceType* xslt_stylesheet_type = NULL;
 
+static void xslt_stylesheet_dtor(ErlNifEnv* env, void* obj) {
+  xslt_stylesheet* stylesheet = (xslt_stylesheet*)obj;
+  if (stylesheet->style != NULL) {
+    xsltFreeStylesheet(stylesheet->style);
+  }
+}
 
-typedef struct _slist {
-  ERL_NIF_TERM data;
-  struct _slist* next;
-} slist;
+static ERL_NIF_TERM make_xslt_stylesheet(ErlNifEnv* env, xsltStylesheetPtr style) {
+  xslt_stylesheet* stylesheet = (xslt_stylesheet*)enif_alloc_resource(xslt_stylesheet_type, sizeof(xslt_stylesheet));
+  if (stylesheet == NULL) {
+    xsltFreeStylesheet(style);
+    return make_error(env, "failed_to_alloc_resource");
+  }
+  stylesheet->style = style;
 
-typedef struct {
-  ErlNifEnv* env;
-  slist* list;
-} structured_data;
+  ERL_NIF_TERM term = enif_make_resource(env, stylesheet);
+  enif_release_resource(stylesheet);
 
-static ERL_NIF_TERM error_to_term(ErlNifEnv* env, xmlErrorPtr error) {
-  // int         domain; /* What part of the library raised this error */
-  // int         code;   /* The error code, e.g. an xmlParserError */
-  // char       *message;/* human-readable informative error message */
-  // xmlErrorLevel level;/* how consequent is the error */
-  // char       *file;   /* the filename */
-  // int         line;   /* the line number if available */
-  // char       *str1;   /* extra string information */
-  // char       *str2;   /* extra string information */
-  // char       *str3;   /* extra string information */
-  // int         int1;   /* extra number information */
-  // int         int2;   /* error column # or 0 if N/A (todo: rename field when we would brk ABI) */
-  // void       *ctxt;   /* the parser context if available */
-  // void       *node;   /* the node in the tree */
-  SET_INT(domain, error->domain);
-  SET_INT(code, error->code);
-  SET_STRING(message, error->message);
-  SET_INT(level, error->level);
-  SET_STRING(file, error->file);
-  SET_INT(line, error->line);
-  SET_STRING(str1, error->str1);
-  SET_STRING(str2, error->str2);
-  SET_STRING(str3, error->str3);
-  SET_INT(int1, error->int1);
-  SET_INT(int2, error->int2);
+  return make_ok(env, term);
+}
 
-  ERL_NIF_TERM map = enif_make_new_map(env);
+static ERL_NIF_TERM xslt_parse_stylesheet(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(content, argv[0]);
 
-  // ignore put errors
-  enif_make_map_put(env, map, enif_make_atom(env, "domain"), domain, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "code"), code, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "message"), message, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "level"), level, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "file"), file, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "line"), line, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "str1"), str1, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "str2"), str2, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "str3"), str3, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "int1"), int1, &map);
-  enif_make_map_put(env, map, enif_make_atom(env, "int2"), int2, &map);
+  xmlDocPtr doc = xmlReadMemory((const char*)content.data, content.size, "noname.xsl", NULL, XSLT_PARSE_OPTIONS);
+  if (doc == NULL) {
+    return make_error(env, "failed_to_parse_document");
+  }
 
-  return map;
+  // the stylesheet owns the document from here on
+  xsltStylesheetPtr style = xsltParseStylesheetDoc(doc);
+  if (style == NULL) {
+    xmlFreeDoc(doc);
+    return make_error(env, "failed_to_parse_stylesheet");
+  }
+
+  return make_xslt_stylesheet(env, style);
 }
+static ERL_NIF_TERM xslt_parse_stylesheet_doc(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_POINTER(xmlDocPtr, doc, argv[0]);
+  if (doc->type != XML_DOCUMENT_NODE) {
+    return enif_make_badarg(env);
+  }
 
-static void structured_error(void* userData, xmlErrorPtr error) {
-  structured_data* data = (structured_data*)userData;
-  ErlNifEnv* env = data->env;
+  // xsltParseStylesheetDoc takes ownership, so leave the caller's document alone
+  xmlDocPtr copy = xmlCopyDoc(doc, 1);
+  if (copy == NULL) {
+    return make_error(env, "failed_to_copy_document");
+  }
 
-  slist* ptr = (slist*)xmlMalloc(sizeof(slist));
-  ptr->data = error_to_term(env, error);
-  ptr->next = data->list;
-  data->list = ptr;
+  xsltStylesheetPtr style = xsltParseStylesheetDoc(copy);
+  if (style == NULL) {
+    xmlFreeDoc(copy);
+    return make_error(env, "failed_to_parse_stylesheet");
+  }
+
+  return make_xslt_stylesheet(env, style);
 }
+static ERL_NIF_TERM xslt_apply_stylesheet(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(xslt_stylesheet, stylesheet, argv[0]);
+  xsltStylesheetPtr style = stylesheet->style;
+  GET_POINTER(xmlDocPtr, doc, argv[1]);
 
-static ERL_NIF_TERM structured_get_result(ErlNifEnv* env, structured_data* sd) {
-  slist* p = sd->list;
-  ERL_NIF_TERM xs = enif_make_list(env, 0);
-  while (p != NULL) {
-    xs = enif_make_list_cell(env, p->data, xs);
-    slist* next = p->next;
-    xmlFree(p);
-    p = next;
+  // flat [name, value, ...] list, values are XPath expressions
+  xmlChar** params;
+  unsigned int params_length;
+  const char* reason = get_xml_char_pp(env, argv[2], &params, &params_length);
+  if (reason != NULL) {
+    return make_error(env, reason);
   }
-  return xs;
+
+  STATS_START(start);
+  xmlDocPtr result = xsltApplyStylesheet(style, doc, (const char**)params);
+  stats_record(STATS_XSLT_TRANSFORM, start, 0, result == NULL);
+  free_xml_char_pp(params, params_length);
+  if (result == NULL) {
+    return make_error(env, "failed_to_apply_stylesheet");
+  }
+
+  SET_POINTER(ptr, result);
+
+  return make_ok(env, ptr);
 }
+// Applies the stylesheet and serializes the result according to its
+// xsl:output settings directly into the returned binary.
+static ERL_NIF_TERM xslt_transform(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_RESOURCE(xslt_stylesheet, stylesheet, argv[0]);
+  xsltStylesheetPtr style = stylesheet->style;
+  GET_POINTER(xmlDocPtr, doc, argv[1]);
 
+  xmlChar** params;
+  unsigned int params_length;
+  const char* reason = get_xml_char_pp(env, argv[2], &params, &params_length);
+  if (reason != NULL) {
+    return make_error(env, reason);
+  }
 
-static ERL_NIF_TERM xml_schema_new_parser_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_BINARY(url, argv[0]);
+  STATS_START(start);
+  xmlDocPtr result = xsltApplyStylesheet(style, doc, (const char**)params);
+  free_xml_char_pp(params, params_length);
+  if (result == NULL) {
+    stats_record(STATS_XSLT_TRANSFORM, start, 0, 1);
+    return make_error(env, "failed_to_apply_stylesheet");
+  }
 
-  char* urlstr = (char*)xmlMalloc(url.size + 1);
-  if (urlstr == NULL) {
-    return make_error(env, "malloc_failed");
+  const xmlChar* encoding;
+  XSLT_GET_IMPORT_PTR(encoding, style, encoding);
+  xmlCharEncodingHandlerPtr encoder = NULL;
+  if (encoding != NULL) {
+    encoder = xmlFindCharEncodingHandler((const char*)encoding);
+    if (encoder != NULL && xmlStrcasecmp((const xmlChar*)encoder->name, (const xmlChar*)"UTF-8") == 0) {
+      encoder = NULL;
+    }
   }
-  memcpy(urlstr, url.data, url.size);
-  urlstr[url.size] = '\0';
 
-  xmlSchemaParserCtxtPtr ctxt = xmlSchemaNewParserCtxt(urlstr);
+  binary_output out;
+  out.size = 0;
+  out.failed = 0;
+  int allocated = enif_alloc_binary(4096, &out.bin);
+  xmlOutputBufferPtr buf = allocated ? xmlOutputBufferCreateIO(binary_output_write, NULL, &out, encoder) : NULL;
+  if (buf == NULL) {
+    // the output buffer owns the encoder only once it exists
+    if (encoder != NULL) {
+      xmlCharEncCloseFunc(encoder);
+    }
+    reason = "failed_to_create_output_buffer";
+  } else {
+    int ret = xsltSaveResultTo(buf, result, style);
+    int close_ret = xmlOutputBufferClose(buf);
+    if (ret < 0 || close_ret < 0) {
+      reason = "failed_to_save_result";
+    }
+  }
+  xmlFreeDoc(result);
+  stats_record(STATS_XSLT_TRANSFORM, start, out.size, reason != NULL);
 
-  xmlFree(urlstr);
+  if (allocated && !out.failed && reason == NULL && enif_realloc_binary(&out.bin, out.size)) {
+    return make_ok(env, enif_make_binary(env, &out.bin));
+  }
+  // a failed write leaves the original allocation in place
+  if (allocated) {
+    enif_release_binary(&out.bin);
+  }
+  return make_error(env, reason != NULL ? reason : "failed_to_realloc_binary");
+}
 
-  SET_POINTER(ptr, ctxt);
+// In-memory resources, keyed by URI, that libxml2 reads instead of touching
+// the file system or network (e.g. xs:import and xs:include targets).
+typedef struct {
+  size_t size;
+  unsigned char data[];
+} resource_entry;
 
-  return make_ok(env, ptr);
+typedef struct {
+  resource_entry* entry;
+  size_t pos;
+} resource_reader;
+
+static xmlHashTablePtr resources = NULL;
+static ErlNifRWLock* resources_lock = NULL;
+static int network_blocked = 0;
+static xmlExternalEntityLoader default_entity_loader = NULL;
+
+static void resource_entry_free(void* payload, xmlChar* name) {
+  xmlFree(payload);
 }
-static ERL_NIF_TERM xml_schema_new_doc_parser_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlDocPtr, doc, argv[0]);
-  xmlSchemaParserCtxtPtr ctxt = xmlSchemaNewDocParserCtxt(doc);
-  SET_POINTER(ptr, ctxt);
-  return make_ok(env, ptr);
+
+static int resource_registered(const char* uri) {
+  enif_rwlock_rlock(resources_lock);
+  int found = xmlHashLookup(resources, (const xmlChar*)uri) != NULL;
+  enif_rwlock_runlock(resources_lock);
+  return found;
 }
-static ERL_NIF_TERM xml_schema_parse(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlSchemaParserCtxtPtr, ctxt, argv[0]);
 
-  structured_data sd = { env, NULL };
-  xmlSchemaSetParserStructuredErrors(ctxt, structured_error, &sd);
+static int resource_match(const char* filename) {
+  return filename != NULL && resource_registered(filename);
+}
 
-  xmlSchemaPtr schema = xmlSchemaParse(ctxt);
+// The reader works on its own copy so unregistering a resource while it is
+// being parsed is safe.
+static void* resource_open(const char* filename) {
+  resource_reader* reader = NULL;
+
+  enif_rwlock_rlock(resources_lock);
+  resource_entry* entry = (resource_entry*)xmlHashLookup(resources, (const xmlChar*)filename);
+  if (entry != NULL) {
+    reader = (resource_reader*)xmlMalloc(sizeof(resource_reader));
+    if (reader != NULL) {
+      reader->entry = (resource_entry*)xmlMalloc(sizeof(resource_entry) + entry->size);
+      if (reader->entry == NULL) {
+        xmlFree(reader);
+        reader = NULL;
+      } else {
+        memcpy(reader->entry, entry, sizeof(resource_entry) + entry->size);
+        reader->pos = 0;
+      }
+    }
+  }
+  enif_rwlock_runlock(resources_lock);
 
-  xmlSchemaSetParserStructuredErrors(ctxt, NULL, NULL);
+  return reader;
+}
 
-  ERL_NIF_TERM xs = structured_get_result(env, &sd);
-  SET_POINTER_OR_NULL(ptr, schema);
-  return make_ok(env, enif_make_tuple2(env, ptr, xs));
+static int resource_read(void* context, char* buffer, int len) {
+  resource_reader* reader = (resource_reader*)context;
+  size_t rest = reader->entry->size - reader->pos;
+  if ((size_t)len > rest) {
+    len = (int)rest;
+  }
+  memcpy(buffer, reader->entry->data + reader->pos, len);
+  reader->pos += len;
+  return len;
 }
-static ERL_NIF_TERM xml_schema_new_valid_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlSchemaPtr, schema, argv[0]);
-  xmlSchemaValidCtxtPtr ctxt = xmlSchemaNewValidCtxt(schema);
-  SET_POINTER(ptr, ctxt);
-  return make_ok(env, ptr);
+
+static int resource_close(void* context) {
+  resource_reader* reader = (resource_reader*)context;
+  xmlFree(reader->entry);
+  xmlFree(reader);
+  return 0;
 }
 
-static ERL_NIF_TERM xml_schema_validate_doc(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlSchemaValidCtxtPtr, ctxt, argv[0]);
-  GET_POINTER(xmlDocPtr, instance, argv[1]);
+// Registered URIs always resolve from memory. Anything else goes through the
+// default loader, which refuses http:// and ftp:// while the network is blocked.
+static xmlParserInputPtr resource_entity_loader(const char* url, const char* id, xmlParserCtxtPtr ctxt) {
+  if (url != NULL && !resource_registered(url) && __atomic_load_n(&network_blocked, __ATOMIC_RELAXED)) {
+    return xmlNoNetExternalEntityLoader(url, id, ctxt);
+  }
+  return default_entity_loader(url, id, ctxt);
+}
 
-  structured_data sd = { env, NULL };
-  xmlSchemaSetValidStructuredErrors(ctxt, structured_error, &sd);
+static ERL_NIF_TERM xml_register_resource(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(uri, argv[0]);
+  GET_BINARY(content, argv[1]);
 
-  int result = xmlSchemaValidateDoc(ctxt, instance);
+  xmlChar* uristr = binary_to_xml_char(&uri);
+  if (uristr == NULL) {
+    return make_error(env, "malloc_failed");
+  }
+  resource_entry* entry = (resource_entry*)xmlMalloc(sizeof(resource_entry) + content.size);
+  if (entry == NULL) {
+    xmlFree(uristr);
+    return make_error(env, "malloc_failed");
+  }
+  entry->size = content.size;
+  memcpy(entry->data, content.data, content.size);
 
-  xmlSchemaSetValidStructuredErrors(ctxt, NULL, NULL);
+  enif_rwlock_rwlock(resources_lock);
+  int ret = xmlHashUpdateEntry(resources, uristr, entry, resource_entry_free);
+  enif_rwlock_rwunlock(resources_lock);
+  xmlFree(uristr);
 
-  ERL_NIF_TERM xs = structured_get_result(env, &sd);
-  SET_INT(value, result);
-  return make_ok(env, enif_make_tuple2(env, value, xs));
+  if (ret != 0) {
+    xmlFree(entry);
+    return make_error(env, "failed_to_register_resource");
+  }
+
+  return enif_make_atom(env, "ok");
 }
-static ERL_NIF_TERM xml_schema_free_parser_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlSchemaParserCtxtPtr, ctxt, argv[0]);
-  xmlSchemaFreeParserCtxt(ctxt);
+
+static ERL_NIF_TERM xml_unregister_resource(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_BINARY(uri, argv[0]);
+
+  xmlChar* uristr = binary_to_xml_char(&uri);
+  if (uristr == NULL) {
+    return make_error(env, "malloc_failed");
+  }
+
+  enif_rwlock_rwlock(resources_lock);
+  xmlHashRemoveEntry(resources, uristr, resource_entry_free);
+  enif_rwlock_rwunlock(resources_lock);
+  xmlFree(uristr);
+
   return enif_make_atom(env, "ok");
 }
-static ERL_NIF_TERM xml_schema_free(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlSchemaPtr, schema, argv[0]);
-  xmlSchemaFree(schema);
+
+static ERL_NIF_TERM xml_clear_resources(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  xmlHashTablePtr table = xmlHashCreate(16);
+  if (table == NULL) {
+    return make_error(env, "failed_to_create_hash");
+  }
+
+  enif_rwlock_rwlock(resources_lock);
+  xmlHashTablePtr old = resources;
+  resources = table;
+  enif_rwlock_rwunlock(resources_lock);
+
+  xmlHashFree(old, resource_entry_free);
+
   return enif_make_atom(env, "ok");
 }
-static ERL_NIF_TERM xml_schema_free_valid_ctxt(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-  GET_POINTER(xmlSchemaValidCtxtPtr, ctxt, argv[0]);
-  xmlSchemaFreeValidCtxt(ctxt);
+
+static ERL_NIF_TERM xml_set_network_blocked(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  GET_INT(blocked, argv[0]);
+
+  __atomic_store_n(&network_blocked, blocked != 0, __ATOMIC_RELAXED);
+
+  return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM get_stats(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  ERL_NIF_TERM result = enif_make_new_map(env);
+
+  for (int i = 0; i < STATS_COUNT; i++) {
+    ERL_NIF_TERM calls = enif_make_uint64(env, __atomic_load_n(&stats[i].calls, __ATOMIC_RELAXED));
+    ERL_NIF_TERM errors = enif_make_uint64(env, __atomic_load_n(&stats[i].errors, __ATOMIC_RELAXED));
+    ERL_NIF_TERM time_ns = enif_make_uint64(env, __atomic_load_n(&stats[i].time_ns, __ATOMIC_RELAXED));
+    ERL_NIF_TERM bytes = enif_make_uint64(env, __atomic_load_n(&stats[i].bytes, __ATOMIC_RELAXED));
+
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    PUT(map, calls);
+    PUT(map, errors);
+    PUT(map, time_ns);
+    PUT(map, bytes);
+
+    if (enif_make_map_put(env, result, enif_make_atom(env, stats_names[i]), map, &result) == 0) {
+      return make_error(env, "failed_to_map_put");
+    }
+  }
+
+  return make_ok(env, result);
+}
+
+static ERL_NIF_TERM reset_stats(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  for (int i = 0; i < STATS_COUNT; i++) {
+    __atomic_store_n(&stats[i].calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[i].errors, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[i].time_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats[i].bytes, 0, __ATOMIC_RELAXED);
+  }
   return enif_make_atom(env, "ok");
 }
 
 static ErlNifFunc nif_funcs[] = {
   // {erl_function_name, erl_function_arity, c_function}
   {"xml_read_memory", 1, xml_read_memory},
+  {"xml_read_file", 1, xml_read_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"xml_read_memory_until", 5, xml_read_memory_until, ERL_NIF_DIRTY_JOB_CPU_BOUND},
   {"xml_copy_doc", 2, xml_copy_doc},
   {"xml_free_doc", 1, xml_free_doc},
 
+  {"xml_pattern_stream_memory", 4, xml_pattern_stream_memory},
+  {"xml_pattern_stream_file", 4, xml_pattern_stream_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"xml_pattern_stream_next", 2, xml_pattern_stream_next, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xml_pattern_stream_close", 1, xml_pattern_stream_close},
+
   {"xml_get_prop", 2, xml_get_prop},
 
   {"xml_doc_copy_node", 3, xml_doc_copy_node},
@@ -975,6 +3856,10 @@ static ErlNifFunc nif_funcs[] = {
   {"xml_doc_set_root_element", 2, xml_doc_set_root_element},
 
   {"xml_new_ns", 3, xml_new_ns},
+  {"xml_new_doc_tree", 2, xml_new_doc_tree, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+
+  {"xml_doc_to_snapshot", 1, xml_doc_to_snapshot, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xml_doc_from_snapshot", 1, xml_doc_from_snapshot, ERL_NIF_DIRTY_JOB_CPU_BOUND},
 
   {"xml_copy_node", 2, xml_copy_node},
   {"xml_unlink_node", 1, xml_unlink_node},
@@ -982,15 +3867,27 @@ static ErlNifFunc nif_funcs[] = {
   {"xml_free_node_list", 1, xml_free_node_list},
 
   {"xml_c14n_doc_dump_memory", 5, xml_c14n_doc_dump_memory},
+  {"xml_c14n_doc_digest", 5, xml_c14n_doc_digest, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xml_c14n_references", 7, xml_c14n_references, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+
+  {"xml_xpath_fields_digest", 2, xml_xpath_fields_digest, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xml_digest_set_new", 0, xml_digest_set_new},
+  {"xml_digest_set_put", 2, xml_digest_set_put},
+  {"xml_digest_set_member", 2, xml_digest_set_member},
+  {"xml_digest_set_size", 1, xml_digest_set_size},
 
   {"xml_xpath_new_context", 1, xml_xpath_new_context},
   {"xml_xpath_free_context", 1, xml_xpath_free_context},
   {"xml_xpath_eval", 2, xml_xpath_eval},
   {"xml_xpath_free_object", 1, xml_xpath_free_object},
 
+  {"xml_freeze_doc", 1, xml_freeze_doc, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xml_frozen_xpath_eval", 4, xml_frozen_xpath_eval, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+
   {"xml_schema_new_parser_ctxt", 1, xml_schema_new_parser_ctxt},
   {"xml_schema_new_doc_parser_ctxt", 1, xml_schema_new_doc_parser_ctxt},
   {"xml_schema_parse", 1, xml_schema_parse},
+  {"xml_schema_parse_memory", 1, xml_schema_parse_memory, ERL_NIF_DIRTY_JOB_CPU_BOUND},
   {"xml_schema_new_valid_ctxt", 1, xml_schema_new_valid_ctxt},
   {"xml_schema_validate_doc", 2, xml_schema_validate_doc},
   {"xml_schema_free_parser_ctxt", 1, xml_schema_free_parser_ctxt},
@@ -998,6 +3895,22 @@ static ErlNifFunc nif_funcs[] = {
   {"xml_schema_free_valid_ctxt", 1, xml_schema_free_valid_ctxt},
   // {"xml_schema_set_parser_errors, 4, xml_schema_set_parser_errors},
 
+  {"xml_relaxng_new_parser_ctxt", 1, xml_relaxng_new_parser_ctxt},
+  {"xml_relaxng_new_doc_parser_ctxt", 1, xml_relaxng_new_doc_parser_ctxt},
+  {"xml_relaxng_parse", 1, xml_relaxng_parse, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xml_relaxng_parse_memory", 1, xml_relaxng_parse_memory, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xml_relaxng_new_valid_ctxt", 1, xml_relaxng_new_valid_ctxt},
+  {"xml_relaxng_validate_doc", 2, xml_relaxng_validate_doc, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+
+  {"xml_dtd_parse_file", 1, xml_dtd_parse_file, ERL_NIF_DIRTY_JOB_IO_BOUND},
+  {"xml_dtd_parse_memory", 1, xml_dtd_parse_memory, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xml_validate_dtd", 2, xml_validate_dtd, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+
+  {"xslt_parse_stylesheet", 1, xslt_parse_stylesheet, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xslt_parse_stylesheet_doc", 1, xslt_parse_stylesheet_doc, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xslt_apply_stylesheet", 3, xslt_apply_stylesheet, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+  {"xslt_transform", 3, xslt_transform, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+
   {"get_xml_node", 1, get_xml_node},
   {"set_xml_node", 2, set_xml_node},
   {"get_xml_char", 1, get_xml_char},
@@ -1006,6 +3919,93 @@ static ErlNifFunc nif_funcs[] = {
   {"set_xml_xpath_context", 2, set_xml_xpath_context},
   {"get_xml_xpath_object", 1, get_xml_xpath_object},
   {"get_xml_node_set", 1, get_xml_node_set},
+  {"get_xml_node_set_page", 4, get_xml_node_set_page, ERL_NIF_DIRTY_JOB_CPU_BOUND},
+
+  {"xml_register_resource", 2, xml_register_resource},
+  {"xml_unregister_resource", 1, xml_unregister_resource},
+  {"xml_clear_resources", 0, xml_clear_resources},
+  {"xml_set_network_blocked", 1, xml_set_network_blocked},
+
+  {"get_stats", 0, get_stats},
+  {"reset_stats", 0, reset_stats},
 };
 
-ERL_NIF_INIT(Elixir.Libxml.Nif, nif_funcs, NULL, NULL, NULL, NULL)
+static int load(ErlNifEnv* env, void** priv_data, ERL_NIF_TERM load_info) {
+  xmlInitParser();
+  xsltInit();
+
+  frozen_doc_type = enif_open_resource_type(env, NULL, "libxml_frozen_doc", frozen_doc_dtor,
+                                            ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+  if (frozen_doc_type == NULL) {
+    return 1;
+  }
+  digest_set_type = enif_open_resource_type(env, NULL, "libxml_digest_set", digest_set_dtor,
+                                            ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+  if (digest_set_type == NULL) {
+    return 1;
+  }
+  xslt_stylesheet_type = enif_open_resource_type(env, NULL, "libxml_xslt_stylesheet", xslt_stylesheet_dtor,
+                                                 ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+  if (xslt_stylesheet_type == NULL) {
+    return 1;
+  }
+  relaxng_parser_ctxt_type = enif_open_resource_type(env, NULL, "libxml_relaxng_parser_ctxt", relaxng_parser_ctxt_dtor,
+                                                      ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+  if (relaxng_parser_ctxt_type == NULL) {
+    return 1;
+  }
+  relaxng_schema_type = enif_open_resource_type(env, NULL, "libxml_relaxng_schema", relaxng_schema_dtor,
+                                                ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+  if (relaxng_schema_type == NULL) {
+    return 1;
+  }
+  relaxng_valid_ctxt_type = enif_open_resource_type(env, NULL, "libxml_relaxng_valid_ctxt", relaxng_valid_ctxt_dtor,
+                                                    ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+  if (relaxng_valid_ctxt_type == NULL) {
+    return 1;
+  }
+  parsed_dtd_type = enif_open_resource_type(env, NULL, "libxml_dtd", parsed_dtd_dtor,
+                                            ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+  if (parsed_dtd_type == NULL) {
+    return 1;
+  }
+  pattern_stream_type = enif_open_resource_type(env, NULL, "libxml_pattern_stream", pattern_stream_dtor,
+                                                ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+  if (pattern_stream_type == NULL) {
+    return 1;
+  }
+
+  // stylesheets may read local files through document(), but must not write
+  // files, create directories or reach the network
+  if (xsltGetDefaultSecurityPrefs() == NULL) {
+    xsltSecurityPrefsPtr prefs = xsltNewSecurityPrefs();
+    if (prefs == NULL ||
+        xsltSetSecurityPrefs(prefs, XSLT_SECPREF_WRITE_FILE, xsltSecurityForbid) != 0 ||
+        xsltSetSecurityPrefs(prefs, XSLT_SECPREF_CREATE_DIRECTORY, xsltSecurityForbid) != 0 ||
+        xsltSetSecurityPrefs(prefs, XSLT_SECPREF_READ_NETWORK, xsltSecurityForbid) != 0 ||
+        xsltSetSecurityPrefs(prefs, XSLT_SECPREF_WRITE_NETWORK, xsltSecurityForbid) != 0) {
+      return 1;
+    }
+    xsltSetDefaultSecurityPrefs(prefs);
+  }
+
+  // the library stays loaded across module reloads, so only register once
+  if (resources == NULL) {
+    resources_lock = enif_rwlock_create((char*)"libxml_resources");
+    resources = xmlHashCreate(16);
+    if (resources_lock == NULL || resources == NULL) {
+      return 1;
+    }
+
+    // registered last, so these are consulted before the default file/http callbacks
+    if (xmlRegisterInputCallbacks(resource_match, resource_open, resource_read, resource_close) < 0) {
+      return 1;
+    }
+    default_entity_loader = xmlGetExternalEntityLoader();
+    xmlSetExternalEntityLoader(resource_entity_loader);
+  }
+
+  return 0;
+}
+
+ERL_NIF_INIT(Elixir.Libxml.Nif, nif_funcs, load, NULL, NULL, NULL)
@@ -154,6 +154,7 @@ defmodule LibxmlTest do
     {:ok, obj} = Libxml.Nif.get_xml_xpath_object(p)
     # XPATH_NODESET
     assert 1 == obj.type
+    assert 2 == obj.node_nr
     {:ok, ns} = Libxml.Nif.get_xml_node_set(obj.nodesetval)
     assert 2 == length(ns.nodes)
 
@@ -312,6 +313,354 @@ defmodule LibxmlTest do
     end)
   end
 
+  test "read_file" do
+    Libxml.safe_read_file("test/all_0.xsd", fn doc ->
+      from_memory = Libxml.safe_read_memory(File.read!("test/all_0.xsd"), &c14n/1)
+      assert from_memory == c14n(doc)
+
+      root = Libxml.doc_get_root_element(doc) |> Libxml.Node.extract()
+      assert "schema" == Libxml.Char.extract(root.name).content
+    end)
+
+    assert {:error, "failed_to_parse_document"} == Libxml.Nif.xml_read_file("test/missing.xml")
+    assert {:error, "failed_to_parse_document"} == Libxml.Nif.xml_read_file("http://localhost/all_0.xsd")
+  end
+
+  test "read_memory_until" do
+    xml =
+      ~s(<e:env xmlns:e="urn:e"><e:head><to>a</to><from>b</from></e:head>) <>
+        ~s(<e:body><x>1</x><x>2</x></e:body></e:env>)
+
+    head = ~s(<e:env xmlns:e="urn:e"><e:head><to>a</to><from>b</from></e:head></e:env>)
+
+    Libxml.safe_read_memory_until(xml, [target: "/q:env/q:head", namespaces: [{"q", "urn:e"}]], fn doc, reason ->
+      assert :target == reason
+      assert head == c14n(doc)
+    end)
+
+    Libxml.safe_read_memory_until(xml, [max_depth: 2], fn doc, reason ->
+      assert :max_depth == reason
+      assert ~s(<e:env xmlns:e="urn:e"><e:head></e:head></e:env>) == c14n(doc)
+    end)
+
+    Libxml.safe_read_memory_until(xml, [max_elements: 3], fn doc, reason ->
+      assert :max_elements == reason
+      assert ~s(<e:env xmlns:e="urn:e"><e:head><to>a</to></e:head></e:env>) == c14n(doc)
+    end)
+
+    Libxml.safe_read_memory_until(xml, [target: "/missing"], fn doc, reason ->
+      assert :eof == reason
+      assert Libxml.safe_read_memory(xml, &c14n/1) == c14n(doc)
+    end)
+
+    assert {:error, "failed_to_compile_pattern"} == Libxml.Nif.xml_read_memory_until(xml, 0, 0, "[", [])
+    assert {:error, "failed_to_parse_document"} == Libxml.Nif.xml_read_memory_until("<a><b></a>", 0, 0, "", [])
+  end
+
+  test "new_doc_tree" do
+    Libxml.safe_read_memory("<old/>", fn doc ->
+      tree =
+        {"doc", [{"id", "1"}],
+         [
+           {"a", [], ["x < y"]},
+           {"b", [{"k", "\"v\""}], []},
+           "tail"
+         ]}
+
+      node = Libxml.new_doc_tree(doc, tree)
+      old = Libxml.doc_set_root_element(doc, node)
+      :ok = Libxml.free_node(old)
+
+      content = Libxml.C14N.doc_dump_memory(doc, nil, :c14n_1_0, [], false)
+      assert ~s(<doc id="1"><a>x &lt; y</a><b k="&quot;v&quot;"></b>tail</doc>) == content
+
+      assert {:error, "failed_to_new_doc_tree"} ==
+               Libxml.Nif.xml_new_doc_tree(doc.pointer, {"doc", [{"id"}], []})
+    end)
+  end
+
+  test "digest" do
+    Libxml.safe_read_memory(@content, fn doc ->
+      contents = Libxml.C14N.doc_dump_memory(doc, nil, :c14n_1_0, [], false)
+      digest = Libxml.C14N.doc_digest(doc, nil, :c14n_1_0, [], false)
+      assert :crypto.hash(:sha256, contents) == digest
+
+      fields = Libxml.Digest.xpath_fields(doc, ["/doc/value", "/doc/compute"])
+      assert 32 == byte_size(fields)
+      assert fields != Libxml.Digest.xpath_fields(doc, ["/doc/compute", "/doc/value"])
+
+      set = Libxml.Digest.Set.new()
+      assert Libxml.Digest.Set.put(set, digest)
+      assert Task.async(fn -> Libxml.Digest.Set.put(set, digest) end) |> Task.await() == false
+      assert Libxml.Digest.Set.member?(set, digest)
+      refute Libxml.Digest.Set.member?(set, fields)
+      assert 1 == Libxml.Digest.Set.size(set)
+    end)
+  end
+
+  test "C14N references" do
+    content = ~s(<doc xmlns:w="urn:w"><a x="1">A</a><!--c--><b w:Id="b1"><c/></b></doc>)
+
+    Libxml.safe_read_memory(content, fn doc ->
+      refs = ["#b1", "/doc/a", ""]
+
+      assert [
+               ~s(<b xmlns:w="urn:w" w:Id="b1"><c></c></b>),
+               ~s(<a xmlns:w="urn:w" x="1">A</a>),
+               ~s(<doc xmlns:w="urn:w"><a x="1">A</a><b w:Id="b1"><c></c></b></doc>)
+             ] == Libxml.C14N.references(doc, refs, :c14n_1_0, [], false)
+
+      digests = Libxml.C14N.references(doc, refs, :c14n_1_0, [], false, :sha256)
+      assert Libxml.C14N.doc_digest(doc, nil, :c14n_1_0, [], false) == List.last(digests)
+
+      assert [~s(<b xmlns:w="urn:w" w:Id="b1"><c></c></b>)] ==
+               Libxml.C14N.references(doc, ["//*[@q:Id]"], :c14n_1_0, [], false, :bytes, [{"q", "urn:w"}])
+
+      assert {:error, "xpath_eval"} ==
+               Libxml.Nif.xml_c14n_references(doc.pointer, ["//*[@q:Id]"], 0, [], 0, 0, [])
+
+      assert {:error, "reference_not_found"} ==
+               Libxml.Nif.xml_c14n_references(doc.pointer, ["#nope"], 0, [], 0, 0, [])
+    end)
+  end
+
+  test "XSLT" do
+    stylesheet = """
+    <xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+      <xsl:output method="text"/>
+      <xsl:param name="sep" select="','"/>
+      <xsl:template match="/">
+        <xsl:for-each select="//i"><xsl:value-of select="."/><xsl:value-of select="$sep"/></xsl:for-each>
+      </xsl:template>
+    </xsl:stylesheet>
+    """
+
+    style = Libxml.XSLT.parse_stylesheet(stylesheet)
+
+    Libxml.safe_read_memory("<r><i>a</i><i>b</i></r>", fn doc ->
+      assert "a,b," == Libxml.XSLT.transform(style, doc)
+      assert "a|b|" == Libxml.XSLT.transform(style, doc, [{"sep", "'|'"}])
+      assert "a,b," == Task.async(fn -> Libxml.XSLT.transform(style, doc) end) |> Task.await()
+
+      Libxml.XSLT.safe_apply_stylesheet(style, doc, fn result ->
+        root = Libxml.Node.extract(result)
+        assert :document_node == root.type
+      end)
+    end)
+
+    writer = """
+    <xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+      <xsl:template match="/"><xsl:document href="test/xslt_written.xml"><w/></xsl:document></xsl:template>
+    </xsl:stylesheet>
+    """
+
+    Libxml.safe_read_memory("<r/>", fn doc ->
+      writer_style = Libxml.XSLT.parse_stylesheet(writer)
+      assert {:error, _} = Libxml.Nif.xslt_transform(writer_style.resource, doc.pointer, [])
+      refute File.exists?("test/xslt_written.xml")
+    end)
+
+    # parsed like xsltproc does: entities substituted, CDATA merged into text
+    entities = """
+    <!DOCTYPE xsl:stylesheet [<!ENTITY sep ", ">]>
+    <xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+      <xsl:output method="text"/>
+      <xsl:template match="/">
+        <xsl:for-each select="//i"><xsl:value-of select="."/><xsl:text>&sep;</xsl:text></xsl:for-each>
+        <xsl:text><![CDATA[<end>]]></xsl:text>
+      </xsl:template>
+    </xsl:stylesheet>
+    """
+
+    Libxml.safe_read_memory("<r><i>a</i><i>b</i></r>", fn doc ->
+      assert "a, b, <end>" == Libxml.XSLT.transform(Libxml.XSLT.parse_stylesheet(entities), doc)
+    end)
+
+    assert {:error, "failed_to_parse_stylesheet"} == Libxml.Nif.xslt_parse_stylesheet("<a/>")
+  end
+
+  test "FrozenDoc" do
+    frozen =
+      Libxml.safe_read_memory(~s(<r><i k="1">a</i><i k="2">b</i></r>), &Libxml.FrozenDoc.freeze/1)
+
+    tasks =
+      for _ <- 1..4 do
+        Task.async(fn -> Libxml.FrozenDoc.xpath_eval(frozen, "//i/@k") end)
+      end
+
+    assert List.duplicate(["1", "2"], 4) == Enum.map(tasks, &Task.await/1)
+    assert 2.0 == Libxml.FrozenDoc.xpath_eval(frozen, "count(//i)")
+    assert "b" == Libxml.FrozenDoc.xpath_eval(frozen, "string(/r/i[2])")
+    assert :nan == Libxml.FrozenDoc.xpath_eval(frozen, "number('x')")
+    assert {:error, "xpath_eval"} ==
+             Libxml.Nif.xml_frozen_xpath_eval(frozen.resource, "//[", 0, [])
+
+    frozen =
+      Libxml.safe_read_memory(~s(<r xmlns="urn:a"><i>a</i></r>), &Libxml.FrozenDoc.freeze/1)
+
+    assert ["a"] == Libxml.FrozenDoc.xpath_eval(frozen, "//p:i", namespaces: [p: "urn:a"])
+    assert {:error, "xpath_eval"} ==
+             Libxml.Nif.xml_frozen_xpath_eval(frozen.resource, "//p:i", 0, [])
+  end
+
+  test "FrozenDoc zero copy" do
+    payload = String.duplicate("QUJD", 64)
+
+    frozen =
+      Libxml.safe_read_memory(
+        ~s(<r><a>#{payload}</a><b><![CDATA[#{payload}]]></b><c k="#{payload}">x<i/>y</c></r>),
+        &Libxml.FrozenDoc.freeze/1
+      )
+
+    for xpath <- ["//a", "//b/text()", "//c/@k", "//c", "//i"] do
+      assert Libxml.FrozenDoc.xpath_eval(frozen, xpath) ==
+               Libxml.FrozenDoc.xpath_eval(frozen, xpath, zero_copy: true)
+    end
+
+    assert [payload] == Libxml.FrozenDoc.xpath_eval(frozen, "//a", zero_copy: true)
+
+    # a zero-copy value points into the document: the binary it references is
+    # the small frozen document resource, not a buffer holding the value
+    big = String.duplicate("QUJD", 16 * 1024)
+    frozen = Libxml.safe_read_memory("<r>#{big}</r>", &Libxml.FrozenDoc.freeze/1)
+
+    [copy] = Libxml.FrozenDoc.xpath_eval(frozen, "/r")
+    [value] = Libxml.FrozenDoc.xpath_eval(frozen, "/r", zero_copy: true)
+    assert big == copy
+    assert big == value
+    assert :binary.referenced_byte_size(copy) >= byte_size(copy)
+    assert :binary.referenced_byte_size(value) < byte_size(value)
+
+    # and it keeps the document alive after every other reference is gone
+    value =
+      Libxml.safe_read_memory("<r>#{big}</r>", fn doc ->
+        [value] = Libxml.FrozenDoc.xpath_eval(Libxml.FrozenDoc.freeze(doc), "/r", zero_copy: true)
+        value
+      end)
+
+    :erlang.garbage_collect()
+    assert :binary.referenced_byte_size(value) < byte_size(value)
+    assert big == value
+  end
+
+  test "Pattern" do
+    xml = ~s(<feed xmlns:a="urn:a"><entry id="e1"><id>1</id></entry><entry><id>2</id><a:link a:href="h"/></entry></feed>)
+    patterns = ["/feed/entry/id", "/feed/entry/@id", "//p:link/@p:href"]
+
+    assert [
+             {"/feed/entry/@id", "e1"},
+             {"/feed/entry/id", "1"},
+             {"/feed/entry/id", "2"},
+             {"//p:link/@p:href", "h"}
+           ] ==
+             Libxml.Pattern.extract_memory(xml, patterns, namespaces: [p: "urn:a"], batch_size: 1)
+
+    assert [{"entry", ~s(<entry id="e1"><id>1</id></entry>)}] ==
+             Libxml.Pattern.stream_memory(xml, ["entry"], output: :outer_xml) |> Enum.take(1)
+
+    # attributes of an element matched by another pattern are still reported
+    assert [{"entry", ~s(<entry id="e1"><id>1</id></entry>)}, {"entry/@id", "e1"}] ==
+             Libxml.Pattern.stream_memory(xml, ["entry", "entry/@id"], output: :outer_xml)
+             |> Enum.take(2)
+
+    # matches nested inside a matched element are reported too
+    assert [
+             {"//entry", "1"},
+             {"//entry/id", "1"},
+             {"//entry", "2"},
+             {"//entry/id", "2"}
+           ] == Libxml.Pattern.extract_memory(xml, ["//entry", "//entry/id"])
+
+    assert_raise ArgumentError, fn ->
+      Libxml.Pattern.extract_memory(xml, ["entry"], batch_size: 0)
+    end
+
+    {:ok, stream} = Libxml.Nif.xml_pattern_stream_memory(xml, ["entry"], [], 0)
+    assert_raise ArgumentError, fn -> Libxml.Nif.xml_pattern_stream_next(stream, 0) end
+    Libxml.Nif.xml_pattern_stream_close(stream)
+
+    assert [{"//@name", "doc"}, {"//@name", "a"}, {"//@name", "b"}, {"//@name", "c"}] ==
+             Libxml.Pattern.extract_file("test/all_0.xsd", ["//@name"])
+
+    assert {:error, "failed_to_new_reader"} ==
+             Libxml.Nif.xml_pattern_stream_file("http://localhost/feed.xml", ["entry"], [], 0)
+
+    assert {:error, "failed_to_compile_pattern"} ==
+             Libxml.Nif.xml_pattern_stream_memory(xml, ["/feed/entry[1]"], [], 0)
+  end
+
+  test "NodeSet pages" do
+    Libxml.safe_read_memory(~s(<r><i k="1">a<b>c</b></i><i k="2"/><i/></r>), fn doc ->
+      Libxml.XPath.safe_new_context(doc, fn ctx ->
+        Libxml.XPath.safe_eval(ctx, "//i", fn obj ->
+          nodeset = Libxml.XPath.Object.extract(obj).content
+
+          assert [%Libxml.Node{}] = Libxml.XPath.NodeSet.page(nodeset, 2, 10)
+          assert ["ac", ""] == Libxml.XPath.NodeSet.page(nodeset, 0, 2, :text)
+          assert [] == Libxml.XPath.NodeSet.page(nodeset, 3, 10, :text)
+
+          assert [[{"k", "1"}], [{"k", "2"}], []] ==
+                   Libxml.XPath.NodeSet.stream(nodeset, :attributes, 2) |> Enum.to_list()
+
+          assert [{"i", [{"k", "1"}], ["a", {"b", [], ["c"]}]}] ==
+                   Libxml.XPath.NodeSet.page(nodeset, 0, 1, :term)
+        end)
+      end)
+    end)
+  end
+
+  test "Snapshot" do
+    content = ~s(<?pi x?><r xmlns:p="urn:p" p:a="1"><p:c><![CDATA[<raw>]]>text<!--c--></p:c><d/></r>)
+
+    snapshot = Libxml.safe_read_memory(content, &Libxml.Snapshot.dump/1)
+    expected = Libxml.safe_read_memory(content, &c14n/1)
+    assert expected == Libxml.Snapshot.safe_load(snapshot, &c14n/1)
+
+    truncated = binary_part(snapshot, 0, byte_size(snapshot) - 1)
+    assert {:error, "invalid_snapshot"} == Libxml.Nif.xml_doc_from_snapshot(truncated)
+    assert {:error, "invalid_snapshot"} == Libxml.Nif.xml_doc_from_snapshot("<r/>")
+  end
+
+  test "telemetry" do
+    Libxml.Telemetry.reset_stats()
+    parent = self()
+    handler_id = "libxml-test-telemetry"
+
+    :ok =
+      :telemetry.attach_many(
+        handler_id,
+        [[:libxml, :read_memory, :stop], [:libxml, :xpath_eval, :stop]],
+        fn event, measurements, metadata, _config ->
+          send(parent, {event, measurements, metadata})
+        end,
+        nil
+      )
+
+    try do
+      Libxml.safe_read_memory(@content, fn doc ->
+        Libxml.XPath.safe_new_context(doc, fn ctx ->
+          Libxml.XPath.safe_eval(ctx, "/doc/compute", fn _ -> :ok end)
+        end)
+      end)
+    after
+      :telemetry.detach(handler_id)
+    end
+
+    size = byte_size(@content)
+    assert_received {[:libxml, :read_memory, :stop], %{duration: _}, %{bytes: ^size}}
+    assert_received {[:libxml, :xpath_eval, :stop], %{duration: _}, %{node_count: 2}}
+
+    stats = Libxml.Telemetry.stats()
+    assert %{calls: 1, errors: 0, bytes: ^size} = stats.read_memory
+    assert %{calls: 1, errors: 0} = stats.xpath_eval
+
+    # DTDs and Relax NG grammars are counted apart from XML Schema
+    {_, []} = Libxml.DTD.parse_memory("<!ELEMENT r EMPTY>")
+    stats = Libxml.Telemetry.stats()
+    assert %{calls: 1, errors: 0} = stats.dtd_parse
+    assert %{calls: 0} = stats.schema_parse
+  end
+
   test "XML Schema NIF" do
     {:ok, parser_ctxt} = Libxml.Nif.xml_schema_new_parser_ctxt("test/all_0.xsd")
     assert 0 != parser_ctxt
@@ -385,6 +734,71 @@ defmodule LibxmlTest do
     end)
   end
 
+  test "XML Schema with in-memory includes" do
+    types = """
+    <xs:schema xmlns:xs="http://www.w3.org/2001/XMLSchema">
+      <xs:simpleType name="code">
+        <xs:restriction base="xs:string"><xs:length value="3"/></xs:restriction>
+      </xs:simpleType>
+    </xs:schema>
+    """
+
+    main = """
+    <xs:schema xmlns:xs="http://www.w3.org/2001/XMLSchema">
+      <xs:include schemaLocation="types.xsd"/>
+      <xs:element name="c" type="code"/>
+    </xs:schema>
+    """
+
+    Libxml.Resolver.register("mem://schemas/types.xsd", types)
+    Libxml.Resolver.register("mem://schemas/main.xsd", main)
+
+    try do
+      Libxml.Schema.safe_new_parser_ctxt("mem://schemas/main.xsd", fn ctxt ->
+        Libxml.Schema.safe_parse(ctxt, fn schema, [] ->
+          Libxml.Schema.safe_new_valid_ctxt(schema, fn ctxt ->
+            Libxml.safe_read_memory("<c>abc</c>", fn doc ->
+              assert {:ok, []} == Libxml.Schema.validate_doc(ctxt, doc)
+            end)
+
+            Libxml.safe_read_memory("<c>abcd</c>", fn doc ->
+              assert {:error, [_]} = Libxml.Schema.validate_doc(ctxt, doc)
+            end)
+          end)
+        end)
+      end)
+
+      main = String.replace(main, "types.xsd", "mem://schemas/types.xsd")
+
+      Libxml.Schema.safe_parse_memory(main, fn schema, errors ->
+        assert 0 != schema.pointer
+        assert [] == errors
+      end)
+    after
+      Libxml.Resolver.clear()
+    end
+  end
+
+  test "XML Schema with blocked network" do
+    schema = """
+    <xs:schema xmlns:xs="http://www.w3.org/2001/XMLSchema">
+      <xs:include schemaLocation="http://127.0.0.1:9/types.xsd"/>
+    </xs:schema>
+    """
+
+    Libxml.Resolver.block_network(true)
+
+    try do
+      Libxml.Schema.safe_parse_memory(schema, fn schema, errors ->
+        assert 0 == schema.pointer
+        assert Enum.any?(errors, &(&1.code == :io_network_attempt))
+        assert Enum.any?(errors, &(&1.code == :schemap_src_include))
+      end)
+    after
+      Libxml.Resolver.block_network(false)
+    end
+  end
+
   @content """
   <?xml version="1.0" encoding="UTF-8"?>
 
@@ -402,6 +816,51 @@ defmodule LibxmlTest do
   </xs:schema>
   """
 
+  test "Relax NG" do
+    rng = """
+    <element name="r" xmlns="http://relaxng.org/ns/structure/1.0">
+      <oneOrMore><element name="i"><text/></element></oneOrMore>
+    </element>
+    """
+
+    {schema, []} = Libxml.RelaxNG.parse_memory(rng)
+    ctxt = Libxml.RelaxNG.new_valid_ctxt(schema)
+
+    Libxml.safe_read_memory("<r><i>a</i></r>", fn doc ->
+      assert {:ok, []} == Libxml.RelaxNG.validate_doc(ctxt, doc)
+    end)
+
+    Libxml.safe_read_memory("<r><j/></r>", fn doc ->
+      assert {:error, [%Libxml.Error{}]} = Libxml.RelaxNG.validate_doc(ctxt, doc)
+    end)
+
+    assert {nil, [_ | _]} = Libxml.RelaxNG.parse_memory("<element/>")
+  end
+
+  test "DTD" do
+    {dtd, []} = Libxml.DTD.parse_memory("<!ELEMENT r (i+)><!ELEMENT i (#PCDATA)>")
+
+    Libxml.safe_read_memory("<r><i>a</i></r>", fn doc ->
+      assert {:ok, []} == Libxml.DTD.validate_doc(dtd, doc)
+    end)
+
+    Libxml.safe_read_memory("<r><j/></r>", fn doc ->
+      assert {:error, [_ | _]} = Libxml.DTD.validate_doc(dtd, doc)
+    end)
+
+    assert {nil, [_ | _]} = Libxml.DTD.parse_memory("<!ELEMENT r (i+>")
+  end
+
+  test "DTD validation keeps document IDs" do
+    content = ~s(<!DOCTYPE r [<!ATTLIST e key ID #IMPLIED>]><r><e key="k1">x</e></r>)
+    {dtd, []} = Libxml.DTD.parse_memory("<!ELEMENT r (e*)><!ELEMENT e (#PCDATA)><!ATTLIST e key CDATA #IMPLIED>")
+
+    Libxml.safe_read_memory(content, fn doc ->
+      assert {:ok, []} == Libxml.DTD.validate_doc(dtd, doc)
+      assert [~s(<e key="k1">x</e>)] == Libxml.C14N.references(doc, ["#k1"], :c14n_1_0, [], false)
+    end)
+  end
+
   test "XML Schema from https://stackoverflow.com/questions/6284827/why-does-this-xml-validation-via-xsd-fail-in-libxml2-but-succeed-in-xmllint-an" do
     Libxml.safe_read_memory(@schema, fn doc ->
       Libxml.Schema.safe_new_doc_parser_ctxt(doc, fn ctxt ->
@@ -453,4 +912,6 @@ defmodule LibxmlTest do
       end)
     end)
   end
+
+  defp c14n(doc), do: Libxml.C14N.doc_dump_memory(doc, nil, :c14n_1_0, [], false)
 end